@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include "devices/ide.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* A block device. */
 struct block
@@ -17,8 +18,13 @@ struct block
     const struct block_operations *ops;  /* Driver operations. */
     void *aux;                          /* Extra data owned by driver. */
 
+    struct semaphore slots;             /* Requests that may still start. */
+    struct lock drain_lock;             /* Held by block_wait_all(). */
+
     unsigned long long read_cnt;        /* Number of sectors read. */
     unsigned long long write_cnt;       /* Number of sectors written. */
+    unsigned long long hit_cnt;         /* Accesses served by a cache. */
+    unsigned long long miss_cnt;        /* Accesses that missed a cache. */
   };
 
 /* List of all block devices. */
@@ -28,6 +34,9 @@ static struct list all_blocks = LIST_INITIALIZER (all_blocks);
 static struct block *block_by_role[BLOCK_ROLE_CNT];
 
 static struct block *list_elem_to_block (struct list_elem *);
+static void transfer (struct block *, block_sector_t, size_t cnt,
+                      bool write, void *const buffers[]);
+static block_request_func wake_submitter;
 
 /* Returns a human-readable name for the given block device
    TYPE. */
@@ -120,9 +129,7 @@ check_sector (struct block *block, block_sector_t sector)
 void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
-  check_sector (block, sector);
-  block->ops->read (block->aux, sector, buffer);
-  block->read_cnt++;
+  block_read_multiple (block, sector, 1, &buffer);
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -133,10 +140,154 @@ block_read (struct block *block, block_sector_t sector, void *buffer)
 void
 block_write (struct block *block, block_sector_t sector, const void *buffer)
 {
-  check_sector (block, sector);
-  ASSERT (block->type != BLOCK_FOREIGN);
-  block->ops->write (block->aux, sector, buffer);
-  block->write_cnt++;
+  block_write_multiple (block, sector, 1, &buffer);
+}
+
+/* Reads the CNT sectors starting at SECTOR from BLOCK, sector
+   SECTOR + I into BUFFERS[I], each of which must have room for
+   BLOCK_SECTOR_SIZE bytes.  A driver that supports it moves the
+   whole run with one command instead of one per sector.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_read_multiple (struct block *block, block_sector_t sector, size_t cnt,
+                     void *const buffers[])
+{
+  transfer (block, sector, cnt, false, buffers);
+}
+
+/* Writes the CNT sectors starting at SECTOR to BLOCK, sector
+   SECTOR + I from BUFFERS[I], each of which must contain
+   BLOCK_SECTOR_SIZE bytes.  Returns after the block device has
+   acknowledged receiving all of them.  A driver that supports it
+   moves the whole run with one command instead of one per
+   sector.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_write_multiple (struct block *block, block_sector_t sector,
+                      size_t cnt, const void *const buffers[])
+{
+  transfer (block, sector, cnt, true, (void *const *) buffers);
+}
+
+/* Submits a request to move CNT sectors between BLOCK and
+   BUFFERS, starting at SECTOR, and waits for it to finish. */
+static void
+transfer (struct block *block, block_sector_t sector, size_t cnt,
+          bool write, void *const buffers[])
+{
+  struct block_request req;
+  struct semaphore done;
+
+  if (cnt == 0)
+    return;
+  sema_init (&done, 0);
+  req.block = block;
+  req.sector = sector;
+  req.cnt = cnt;
+  req.write = write;
+  req.buffers = buffers;
+  req.done = wake_submitter;
+  req.aux = &done;
+  block_submit (&req);
+  sema_down (&done);
+}
+
+/* Completion function for transfer(). */
+static void
+wake_submitter (struct block_request *req)
+{
+  sema_up (req->aux);
+}
+
+/* Starts REQ and returns without waiting for it to finish.
+   REQ's DONE function is called once it has.  Requests to a
+   device are not necessarily carried out in the order they were
+   submitted.  If REQ's device already has BLOCK_MAX_IN_FLIGHT
+   requests in flight, first waits for one of them to finish.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_submit (struct block_request *req)
+{
+  struct block *block = req->block;
+
+  ASSERT (req->cnt > 0);
+  ASSERT (req->done != NULL);
+  check_sector (block, req->sector);
+  check_sector (block, req->sector + req->cnt - 1);
+  ASSERT (!req->write || block->type != BLOCK_FOREIGN);
+
+  sema_down (&block->slots);
+  req->dev_sector = req->sector;
+  block_forward (block, req);
+}
+
+/* Passes REQ, whose DEV_SECTOR must already be relative to
+   BLOCK, on to BLOCK's driver.  For use by drivers layered on
+   top of another block device, such as partitions.  A driver
+   without a SUBMIT operation carries out REQ at once, one sector
+   at a time. */
+void
+block_forward (struct block *block, struct block_request *req)
+{
+  size_t i;
+
+  if (req->write)
+    block->write_cnt += req->cnt;
+  else
+    block->read_cnt += req->cnt;
+
+  if (block->ops->submit != NULL)
+    block->ops->submit (block->aux, req);
+  else
+    {
+      for (i = 0; i < req->cnt; i++)
+        if (req->write)
+          block->ops->write (block->aux, req->dev_sector + i,
+                             req->buffers[i]);
+        else
+          block->ops->read (block->aux, req->dev_sector + i,
+                            req->buffers[i]);
+      block_complete (req);
+    }
+}
+
+/* Called by a driver when it has finished REQ.  Calls REQ's
+   DONE function and lets another request start on REQ's
+   device. */
+void
+block_complete (struct block_request *req)
+{
+  struct block *block = req->block;
+
+  req->done (req);
+  sema_up (&block->slots);
+}
+
+/* Waits until no request is in flight on any block device, so
+   that every request submitted before the call has finished.
+   Requests submitted meanwhile wait until a device has drained
+   before they start. */
+void
+block_wait_all (void)
+{
+  struct list_elem *e;
+  int i;
+
+  for (e = list_begin (&all_blocks); e != list_end (&all_blocks);
+       e = list_next (e))
+    {
+      struct block *block = list_entry (e, struct block, list_elem);
+
+      lock_acquire (&block->drain_lock);
+      for (i = 0; i < BLOCK_MAX_IN_FLIGHT; i++)
+        sema_down (&block->slots);
+      for (i = 0; i < BLOCK_MAX_IN_FLIGHT; i++)
+        sema_up (&block->slots);
+      lock_release (&block->drain_lock);
+    }
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -160,6 +311,17 @@ block_type (struct block *block)
   return block->type;
 }
 
+/* Records that an access to BLOCK through a cache in front of it
+   was a hit if HIT is true, or a miss otherwise. */
+void
+block_record_cache (struct block *block, bool hit)
+{
+  if (hit)
+    block->hit_cnt++;
+  else
+    block->miss_cnt++;
+}
+
 /* Prints statistics for each block device used for a Pintos role. */
 void
 block_print_stats (void)
@@ -174,6 +336,10 @@ block_print_stats (void)
           printf ("%s (%s): %llu reads, %llu writes\n",
                   block->name, block_type_name (block->type),
                   block->read_cnt, block->write_cnt);
+          if (block->hit_cnt + block->miss_cnt > 0)
+            printf ("%s (%s): %llu cache hits, %llu cache misses\n",
+                    block->name, block_type_name (block->type),
+                    block->hit_cnt, block->miss_cnt);
         }
     }
 }
@@ -198,8 +364,12 @@ block_register (const char *name, enum block_type type,
   block->size = size;
   block->ops = ops;
   block->aux = aux;
+  sema_init (&block->slots, BLOCK_MAX_IN_FLIGHT);
+  lock_init (&block->drain_lock);
   block->read_cnt = 0;
   block->write_cnt = 0;
+  block->hit_cnt = 0;
+  block->miss_cnt = 0;
 
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
@@ -1,8 +1,10 @@
 #ifndef DEVICES_BLOCK_H
 #define DEVICES_BLOCK_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <inttypes.h>
+#include <list.h>
 
 /* Size of a block device sector in bytes.
    All IDE disks use this sector size, as do most USB and SCSI
@@ -53,22 +55,75 @@ struct block *block_next (struct block *);
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_read_multiple (struct block *, block_sector_t, size_t cnt,
+                          void *const buffers[]);
+void block_write_multiple (struct block *, block_sector_t, size_t cnt,
+                           const void *const buffers[]);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
+/* Asynchronous requests. */
+
+struct block_request;
+
+/* Called when a request has finished. */
+typedef void block_request_func (struct block_request *);
+
+/* A request to read or write CNT consecutive sectors of BLOCK
+   starting at SECTOR, sector SECTOR + I to or from BUFFERS[I].
+   The request must stay in place until DONE has been called.
+   DONE runs in a kernel thread, usually the driver's, so it
+   should do little more than wake up a waiter.
+
+   Each device has at most BLOCK_MAX_IN_FLIGHT requests in flight
+   at once; block_submit() waits for one of them to finish before
+   starting another. */
+struct block_request
+  {
+    /* Set by the submitter. */
+    struct block *block;        /* Device. */
+    block_sector_t sector;      /* First sector. */
+    size_t cnt;                 /* Number of sectors. */
+    bool write;                 /* Write, instead of read? */
+    void *const *buffers;       /* One buffer per sector. */
+    block_request_func *done;   /* Called on completion. */
+    void *aux;                  /* For DONE's use. */
+
+    /* Owned by the block layer and the driver. */
+    block_sector_t dev_sector;  /* SECTOR on the driver's device. */
+    struct list_elem elem;      /* Driver's queue element. */
+    int64_t deadline;           /* Driver's scheduling deadline. */
+  };
+
+/* Most requests in flight on one block device at a time. */
+#define BLOCK_MAX_IN_FLIGHT 32
+
+void block_submit (struct block_request *);
+void block_wait_all (void);
+
 /* Statistics. */
+void block_record_cache (struct block *, bool hit);
 void block_print_stats (void);
 
 /* Lower-level interface to block device drivers. */
 
+/* A driver provides either SUBMIT or both READ and WRITE. */
 struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+
+    /* Starts the request, whose DEV_SECTOR is relative to this
+       device, and returns without waiting for it.  The driver
+       passes the request to block_complete() once it has
+       finished. */
+    void (*submit) (void *aux, struct block_request *);
   };
 
 struct block *block_register (const char *name, enum block_type,
                               const char *extra_info, block_sector_t size,
                               const struct block_operations *, void *aux);
+void block_forward (struct block *, struct block_request *);
+void block_complete (struct block_request *);
 
 #endif /* devices/block.h */
@@ -1,6 +1,7 @@
 #include "devices/ide.h"
 #include <ctype.h>
 #include <debug.h>
+#include <list.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include "devices/block.h"
@@ -8,10 +9,21 @@
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
-   controller.  It attempts to comply to [ATA-3]. */
+   controller.  It attempts to comply to [ATA-3].
+
+   Requests submitted to a disk wait in that disk's queue.  Each
+   channel has a kernel thread that takes requests off the queues
+   of its two disks, merges requests for adjacent sectors into a
+   single command, and carries them out.  If the controller is a
+   PCI bus master, as the PIIX IDE function emulated by QEMU is,
+   data moves by DMA with one interrupt per command; otherwise it
+   moves by PIO, one interrupt per sector. */
 
 /* ATA command block port addresses. */
 #define reg_data(CHANNEL) ((CHANNEL)->reg_base + 0)     /* Data. */
@@ -34,6 +46,7 @@
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -49,6 +62,48 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_DMA 0xc8               /* READ DMA. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA. */
+
+/* Most sectors one READ or WRITE command can move.  A sector
+   count of 0 in the command means this many. */
+#define MAX_CMD_SECTORS 256
+
+/* Bus master IDE port addresses, relative to a channel's
+   bus master base. */
+#define reg_bm_command(CHANNEL) ((CHANNEL)->bm_base + 0) /* Command. */
+#define reg_bm_status(CHANNEL) ((CHANNEL)->bm_base + 2)  /* Status. */
+#define reg_bm_prdt(CHANNEL) ((CHANNEL)->bm_base + 4)    /* PRD table. */
+
+/* Bus master Command Register bits. */
+#define BM_START 0x01           /* Start transfer. */
+#define BM_READ 0x08            /* Transfer from disk to memory. */
+
+/* Bus master Status Register bits. */
+#define BM_ERR 0x02             /* Error, write 1 to clear. */
+#define BM_INTR 0x04            /* Interrupt, write 1 to clear. */
+
+/* Physical Region Descriptor, one entry in the table that tells
+   a bus master where in memory to transfer data.  A region may
+   not cross a 64 kB boundary. */
+struct prd
+  {
+    uint32_t addr;              /* Physical address. */
+    uint16_t size;              /* Bytes, with 0 meaning 64 kB. */
+    uint16_t flags;             /* PRD_EOT on the last entry. */
+  };
+#define PRD_EOT 0x8000          /* End of table. */
+#define PRD_CNT (PGSIZE / sizeof (struct prd))
+
+/* PCI configuration space access. */
+#define PCI_CONFIG_ADDR 0xcf8
+#define PCI_CONFIG_DATA 0xcfc
+#define PCI_COMMAND_IO 0x0001           /* Decode I/O accesses. */
+#define PCI_COMMAND_MASTER 0x0004       /* Act as bus master. */
+
+/* A request at the front of a queue for this many ticks is
+   carried out next, whatever its position on disk. */
+#define DEADLINE_TICKS (TIMER_FREQ / 2)
 
 /* An ATA device. */
 struct ata_disk
@@ -57,6 +112,10 @@ struct ata_disk
     struct channel *channel;    /* Channel that disk is attached to. */
     int dev_no;                 /* Device 0 or 1 for master or slave. */
     bool is_ata;                /* Is device an ATA disk? */
+
+    /* Protected by the channel's queue_lock. */
+    struct list queue;          /* Pending block_requests, oldest first. */
+    block_sector_t head;        /* Sector following the last transfer. */
   };
 
 /* An ATA channel (aka controller).
@@ -71,6 +130,12 @@ struct channel
     bool expecting_interrupt;   /* True if an interrupt is expected, false if
                                    any interrupt would be spurious. */
     struct semaphore completion_wait;   /* Up'd by interrupt handler. */
+    uint16_t bm_base;           /* Bus master base port, or 0 for PIO. */
+    struct prd *prdt;           /* PRD table, if BM_BASE is nonzero. */
+
+    struct lock queue_lock;     /* Protects the disks' queues. */
+    struct condition queue_ready;   /* Signaled when a request arrives. */
+    int last_dev;               /* Device served last. */
 
     struct ata_disk devices[2];     /* The devices on this channel. */
   };
@@ -85,7 +150,13 @@ static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
 
-static void select_sector (struct ata_disk *, block_sector_t);
+static uint16_t find_bus_master (void);
+static thread_func channel_thread NO_RETURN;
+static struct ata_disk *next_disk (struct channel *);
+static void take_requests (struct ata_disk *, struct list *batch);
+static void transfer_batch (struct ata_disk *, struct list *batch);
+
+static void select_sector (struct ata_disk *, block_sector_t, size_t cnt);
 static void issue_pio_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
@@ -101,6 +172,7 @@ static void interrupt_handler (struct intr_frame *);
 void
 ide_init (void) 
 {
+  uint16_t bm_base = find_bus_master ();
   size_t chan_no;
 
   for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
@@ -126,6 +198,11 @@ ide_init (void)
       lock_init (&c->lock);
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
+      c->bm_base = bm_base != 0 ? bm_base + chan_no * 8 : 0;
+      c->prdt = bm_base != 0 ? palloc_get_page (PAL_ASSERT) : NULL;
+      lock_init (&c->queue_lock);
+      cond_init (&c->queue_ready);
+      c->last_dev = 1;
  
       /* Initialize devices. */
       for (dev_no = 0; dev_no < 2; dev_no++)
@@ -136,6 +213,8 @@ ide_init (void)
           d->channel = c;
           d->dev_no = dev_no;
           d->is_ata = false;
+          list_init (&d->queue);
+          d->head = 0;
         }
 
       /* Register interrupt handler. */
@@ -148,6 +227,10 @@ ide_init (void)
       if (check_device_type (&c->devices[0]))
         check_device_type (&c->devices[1]);
 
+      /* Start the thread that serves the disks' queues. */
+      if (c->devices[0].is_ata || c->devices[1].is_ata)
+        thread_create (c->name, PRI_MAX, channel_thread, c);
+
       /* Read hard disk identity information. */
       for (dev_no = 0; dev_no < 2; dev_no++)
         if (c->devices[dev_no].is_ata)
@@ -271,15 +354,18 @@ identify_ata_device (struct ata_disk *d)
   /* Send the IDENTIFY DEVICE command, wait for an interrupt
      indicating the device's response is ready, and read the data
      into our buffer. */
+  lock_acquire (&c->lock);
   select_device_wait (d);
   issue_pio_command (c, CMD_IDENTIFY_DEVICE);
   sema_down (&c->completion_wait);
   if (!wait_while_busy (d))
     {
+      lock_release (&c->lock);
       d->is_ata = false;
       return;
     }
   input_sector (c, id);
+  lock_release (&c->lock);
 
   /* Calculate capacity.
      Read model name and serial number. */
@@ -337,63 +423,404 @@ descramble_ata_string (char *string, int size)
   return string;
 }
 
-/* Reads sector SEC_NO from disk D into BUFFER, which must have
-   room for BLOCK_SECTOR_SIZE bytes.
-   Internally synchronizes accesses to disks, so external
-   per-disk locking is unneeded. */
+/* Bus master detection. */
+
+/* Reads the 32-bit register at offset REG in the PCI
+   configuration space of function FUNC of device DEV on BUS. */
+static uint32_t
+pci_read_config (int bus, int dev, int func, int reg)
+{
+  outl (PCI_CONFIG_ADDR,
+        0x80000000 | (bus << 16) | (dev << 11) | (func << 8) | reg);
+  return inl (PCI_CONFIG_DATA);
+}
+
+/* Writes VALUE to the 32-bit register at offset REG in the PCI
+   configuration space of function FUNC of device DEV on BUS. */
 static void
-ide_read (void *d_, block_sector_t sec_no, void *buffer)
+pci_write_config (int bus, int dev, int func, int reg, uint32_t value)
 {
-  struct ata_disk *d = d_;
-  struct channel *c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
-  lock_release (&c->lock);
+  outl (PCI_CONFIG_ADDR,
+        0x80000000 | (bus << 16) | (dev << 11) | (func << 8) | reg);
+  outl (PCI_CONFIG_DATA, value);
 }
 
-/* Write sector SEC_NO to disk D from BUFFER, which must contain
-   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
-   acknowledged receiving the data.
+/* Looks on PCI bus 0 for an IDE controller that can act as a
+   bus master, enables bus mastering on it, and returns the base
+   of its bus master ports, which serve the primary channel and,
+   8 ports further on, the secondary channel.  Returns 0 if there
+   is no such controller, in which case we fall back to PIO. */
+static uint16_t
+find_bus_master (void)
+{
+  int dev, func;
+
+  for (dev = 0; dev < 32; dev++)
+    for (func = 0; func < 8; func++)
+      {
+        uint32_t class, bar4, command;
+
+        if ((pci_read_config (0, dev, func, 0x00) & 0xffff) == 0xffff)
+          continue;
+
+        /* Class 1, subclass 1 is an IDE controller.  Bit 7 of the
+           programming interface says it can be a bus master. */
+        class = pci_read_config (0, dev, func, 0x08);
+        if ((class >> 16) != 0x0101 || (class & 0x8000) == 0)
+          continue;
+
+        /* BAR4 holds the bus master ports, in I/O space. */
+        bar4 = pci_read_config (0, dev, func, 0x20);
+        if ((bar4 & 1) == 0 || (bar4 & 0xfffc) == 0)
+          continue;
+
+        command = pci_read_config (0, dev, func, 0x04) & 0xffff;
+        pci_write_config (0, dev, func, 0x04,
+                          command | PCI_COMMAND_IO | PCI_COMMAND_MASTER);
+        return bar4 & 0xfffc;
+      }
+  return 0;
+}
+
+/* Request queues. */
+
+/* Starts REQ on disk D by adding it to D's queue.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_write (void *d_, block_sector_t sec_no, const void *buffer)
+ide_submit (void *d_, struct block_request *req)
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
-  lock_release (&c->lock);
+
+  req->deadline = timer_ticks () + DEADLINE_TICKS;
+  lock_acquire (&c->queue_lock);
+  list_push_back (&d->queue, &req->elem);
+  cond_signal (&c->queue_ready, &c->queue_lock);
+  lock_release (&c->queue_lock);
 }
 
 static struct block_operations ide_operations =
   {
-    ide_read,
-    ide_write
+    NULL,
+    NULL,
+    ide_submit
   };
-
+
+/* Thread that carries out the requests queued for the disks on
+   channel C_, one batch at a time. */
+static void
+channel_thread (void *c_)
+{
+  struct channel *c = c_;
+
+  for (;;)
+    {
+      struct ata_disk *d;
+      struct list batch;
+
+      lock_acquire (&c->queue_lock);
+      while ((d = next_disk (c)) == NULL)
+        cond_wait (&c->queue_ready, &c->queue_lock);
+      take_requests (d, &batch);
+      lock_release (&c->queue_lock);
+
+      lock_acquire (&c->lock);
+      transfer_batch (d, &batch);
+      lock_release (&c->lock);
+
+      /* A request may be freed once it is complete, so remove
+         it from BATCH first. */
+      while (!list_empty (&batch))
+        {
+          struct list_elem *e = list_pop_front (&batch);
+          block_complete (list_entry (e, struct block_request, elem));
+        }
+    }
+}
+
+/* Returns the disk on channel C to serve next, taking turns if
+   both have requests, or a null pointer if neither does.
+   Must be called with C's queue_lock held. */
+static struct ata_disk *
+next_disk (struct channel *c)
+{
+  int i;
+
+  for (i = 1; i <= 2; i++)
+    {
+      struct ata_disk *d = &c->devices[(c->last_dev + i) % 2];
+      if (!list_empty (&d->queue))
+        {
+          c->last_dev = d->dev_no;
+          return d;
+        }
+    }
+  return NULL;
+}
+
+/* Moves the requests to serve next from D's queue, which must
+   not be empty, into BATCH, in sector order.
+
+   The first request is the one nearest at or after D's head in
+   C-LOOK order, so that the disk sweeps upward and then starts
+   over from the lowest sector asked for, unless the oldest
+   request has waited past its deadline, in which case it goes
+   first.  Queued requests in the same direction that adjoin the
+   batch at either end are merged into it, as long as the whole
+   batch fits in one command.
+
+   Must be called with the channel's queue_lock held. */
+static void
+take_requests (struct ata_disk *d, struct list *batch)
+{
+  struct block_request *first, *req;
+  block_sector_t start, end;
+  struct list_elem *e;
+  bool merged;
+
+  ASSERT (!list_empty (&d->queue));
+
+  first = list_entry (list_front (&d->queue), struct block_request, elem);
+  if (timer_ticks () < first->deadline)
+    for (e = list_begin (&d->queue); e != list_end (&d->queue);
+         e = list_next (e))
+      {
+        req = list_entry (e, struct block_request, elem);
+        if (req->dev_sector - d->head < first->dev_sector - d->head)
+          first = req;
+      }
+
+  list_init (batch);
+  list_remove (&first->elem);
+  list_push_back (batch, &first->elem);
+  start = first->dev_sector;
+  end = start + first->cnt;
+
+  do
+    {
+      merged = false;
+      for (e = list_begin (&d->queue); e != list_end (&d->queue);
+           e = list_next (e))
+        {
+          req = list_entry (e, struct block_request, elem);
+          if (req->write != first->write
+              || end - start + req->cnt > MAX_CMD_SECTORS)
+            continue;
+          if (req->dev_sector == end)
+            {
+              list_remove (e);
+              list_push_back (batch, e);
+              end += req->cnt;
+            }
+          else if (req->dev_sector + req->cnt == start)
+            {
+              list_remove (e);
+              list_push_front (batch, e);
+              start = req->dev_sector;
+            }
+          else
+            continue;
+          merged = true;
+          break;
+        }
+    }
+  while (merged);
+}
+
+/* Transfers. */
+
+/* A position within a batch of requests. */
+struct cursor
+  {
+    struct list_elem *e;        /* Current request. */
+    size_t idx;                 /* Next sector within it. */
+  };
+
+/* Returns the buffer for the sector at CUR and advances CUR. */
+static void *
+next_buffer (struct cursor *cur)
+{
+  struct block_request *req = list_entry (cur->e, struct block_request, elem);
+  void *buffer = req->buffers[cur->idx];
+
+  if (++cur->idx >= req->cnt)
+    {
+      cur->e = list_next (cur->e);
+      cur->idx = 0;
+    }
+  return buffer;
+}
+
+/* Returns true if every buffer in BATCH may be the target of a
+   DMA transfer on channel C. */
+static bool
+can_dma (struct channel *c, struct list *batch)
+{
+  struct list_elem *e;
+  size_t i;
+
+  if (c->bm_base == 0)
+    return false;
+  for (e = list_begin (batch); e != list_end (batch); e = list_next (e))
+    {
+      struct block_request *req = list_entry (e, struct block_request, elem);
+      for (i = 0; i < req->cnt; i++)
+        if (!is_kernel_vaddr (req->buffers[i])
+            || ((uintptr_t) req->buffers[i] & 1) != 0)
+          return false;
+    }
+  return true;
+}
+
+/* Appends the SIZE bytes at physical address ADDR to the CNT
+   entries in PRDT, extending the last entry if the bytes follow
+   it directly and starting a new one at each 64 kB boundary.
+   Returns the new number of entries. */
+static size_t
+add_region (struct prd *prdt, size_t cnt, uint32_t addr, uint32_t size)
+{
+  while (size > 0)
+    {
+      uint32_t chunk = 0x10000 - (addr & 0xffff);
+      if (chunk > size)
+        chunk = size;
+
+      if (cnt > 0 && (addr & 0xffff) != 0
+          && prdt[cnt - 1].addr + prdt[cnt - 1].size == addr)
+        prdt[cnt - 1].size += chunk;
+      else
+        {
+          ASSERT (cnt < PRD_CNT);
+          prdt[cnt].addr = addr;
+          prdt[cnt].size = chunk;
+          prdt[cnt].flags = 0;
+          cnt++;
+        }
+      addr += chunk;
+      size -= chunk;
+    }
+  return cnt;
+}
+
+/* Moves the CNT sectors starting at SEC_NO between disk D and
+   the buffers at CUR by DMA, with a single command.  C's lock
+   must be held. */
+static void
+dma_transfer (struct ata_disk *d, block_sector_t sec_no, size_t cnt,
+              bool write, struct cursor *cur)
+{
+  struct channel *c = d->channel;
+  uint8_t direction = write ? 0 : BM_READ;
+  uint8_t bm_status;
+  size_t prd_cnt = 0;
+  size_t i;
+
+  /* Each sector adds at most two entries, so the table fits. */
+  for (i = 0; i < cnt; i++)
+    prd_cnt = add_region (c->prdt, prd_cnt, vtop (next_buffer (cur)),
+                          BLOCK_SECTOR_SIZE);
+  c->prdt[prd_cnt - 1].flags = PRD_EOT;
+
+  outl (reg_bm_prdt (c), vtop (c->prdt));
+  outb (reg_bm_command (c), direction);
+  outb (reg_bm_status (c), BM_ERR | BM_INTR);
+
+  select_sector (d, sec_no, cnt);
+  issue_pio_command (c, write ? CMD_WRITE_DMA : CMD_READ_DMA);
+  outb (reg_bm_command (c), direction | BM_START);
+  sema_down (&c->completion_wait);
+
+  bm_status = inb (reg_bm_status (c));
+  outb (reg_bm_command (c), direction);
+  outb (reg_bm_status (c), BM_ERR | BM_INTR);
+  if ((bm_status & BM_ERR) != 0 || (inb (reg_alt_status (c)) & STA_ERR) != 0)
+    PANIC ("%s: disk %s failed, sectors %"PRDSNu"+%zu",
+           d->name, write ? "write" : "read", sec_no, cnt);
+}
+
+/* Moves the CNT sectors starting at SEC_NO between disk D and
+   the buffers at CUR by PIO, with a single command.  In PIO mode
+   the disk interrupts once per sector: when a sector's data is
+   ready to be read, or after it has received a written sector.
+   C's lock must be held. */
+static void
+pio_transfer (struct ata_disk *d, block_sector_t sec_no, size_t cnt,
+              bool write, struct cursor *cur)
+{
+  struct channel *c = d->channel;
+  size_t i;
+
+  select_sector (d, sec_no, cnt);
+  issue_pio_command (c, write ? CMD_WRITE_SECTOR_RETRY
+                              : CMD_READ_SECTOR_RETRY);
+  for (i = 0; i < cnt; i++)
+    {
+      if (!write)
+        sema_down (&c->completion_wait);
+      if (!wait_while_busy (d))
+        PANIC ("%s: disk %s failed, sector=%"PRDSNu,
+               d->name, write ? "write" : "read", sec_no + i);
+      if (write)
+        {
+          output_sector (c, next_buffer (cur));
+          sema_down (&c->completion_wait);
+        }
+      else
+        input_sector (c, next_buffer (cur));
+    }
+}
+
+/* Carries out the requests in BATCH, which are for consecutive
+   sectors of disk D, in order, and all go in the same direction,
+   with one command per MAX_CMD_SECTORS sectors.  The disk's
+   channel's lock must be held. */
+static void
+transfer_batch (struct ata_disk *d, struct list *batch)
+{
+  struct block_request *first = list_entry (list_front (batch),
+                                            struct block_request, elem);
+  bool dma = can_dma (d->channel, batch);
+  block_sector_t sec_no = first->dev_sector;
+  struct cursor cur;
+  struct list_elem *e;
+  size_t cnt = 0;
+
+  for (e = list_begin (batch); e != list_end (batch); e = list_next (e))
+    cnt += list_entry (e, struct block_request, elem)->cnt;
+
+  cur.e = list_begin (batch);
+  cur.idx = 0;
+  while (cnt > 0)
+    {
+      size_t run = cnt < MAX_CMD_SECTORS ? cnt : MAX_CMD_SECTORS;
+
+      if (dma)
+        dma_transfer (d, sec_no, run, first->write, &cur);
+      else
+        pio_transfer (d, sec_no, run, first->write, &cur);
+      sec_no += run;
+      cnt -= run;
+    }
+
+  lock_acquire (&d->channel->queue_lock);
+  d->head = sec_no;
+  lock_release (&d->channel->queue_lock);
+}
+
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and the count CNT of sectors to transfer to the
+   disk's sector selection registers.  (We use LBA mode.) */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+select_sector (struct ata_disk *d, block_sector_t sec_no, size_t cnt)
 {
   struct channel *c = d->channel;
 
-  ASSERT (sec_no < (1UL << 28));
+  ASSERT (sec_no + cnt <= (1UL << 28));
+  ASSERT (cnt >= 1 && cnt <= MAX_CMD_SECTORS);
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt == MAX_CMD_SECTORS ? 0 : cnt);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
@@ -1,5 +1,6 @@
 #include "devices/timer.h"
 #include <debug.h>
+#include <heap.h>
 #include <inttypes.h>
 #include <round.h>
 #include <stdio.h>
@@ -24,7 +25,18 @@ static int64_t ticks;
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
 
+/* Sleeping threads, earliest wake-up tick first. */
+static struct heap sleepers;
+
+/* Wake-up tick of the front of SLEEPERS, or INT64_MAX if no
+   thread is asleep.  Ticks before this one have nothing to wake,
+   so the interrupt handler does not touch the sleep queue at
+   all on them. */
+static int64_t next_wakeup;
+
 static intr_handler_func timer_interrupt;
+static heap_less_func wakeup_less;
+static void wake_sleepers (void);
 static bool too_many_loops (unsigned loops);
 static void busy_wait (int64_t loops);
 static void real_time_sleep (int64_t num, int32_t denom);
@@ -35,6 +47,9 @@ static void real_time_delay (int64_t num, int32_t denom);
 void
 timer_init (void) 
 {
+  heap_init (&sleepers, wakeup_less, NULL);
+  next_wakeup = INT64_MAX;
+
   pit_configure_channel (0, 2, TIMER_FREQ);
   intr_register_ext (0x20, timer_interrupt, "8254 Timer");
 }
@@ -90,16 +105,30 @@ void
 timer_sleep (int64_t ticks) 
 {
   if(ticks <= 0) return;
+  timer_sleep_until (timer_ticks () + ticks);
+}
 
-  int64_t start = timer_ticks ();
-  
-  ASSERT (intr_get_level () == INTR_ON);
-
+/* Sleeps until the timer tick count reaches WAKEUP, which is an
+   absolute value on the timer_ticks() scale.  Returns at once if
+   WAKEUP has already passed.  Interrupts must be turned on. */
+void
+timer_sleep_until (int64_t wakeup) 
+{
   struct thread *cur = thread_current ();
-  // When timer_interrupt happen, does all thread get to deal with it
+  enum intr_level old_level;
+
+  ASSERT (intr_get_level () == INTR_ON);
 
-  cur->sleep_time = start + ticks;
-  sema_down(&(cur->sleep_semaphore));
+  old_level = intr_disable ();
+  if (wakeup > ticks)
+    {
+      cur->wakeup_tick = wakeup;
+      heap_push (&sleepers, &cur->sleep_elem);
+      if (wakeup < next_wakeup)
+        next_wakeup = wakeup;
+      thread_block ();
+    }
+  intr_set_level (old_level);
 }
 
 /* Sleeps for approximately MS milliseconds.  Interrupts must be
@@ -178,6 +207,47 @@ timer_interrupt (struct intr_frame *args UNUSED)
 {
   ticks++;
   thread_tick ();
+  if (ticks >= next_wakeup)
+    wake_sleepers ();
+}
+
+/* Unblocks every sleeping thread whose wake-up tick has come,
+   which costs time proportional to the number of threads woken
+   rather than the number asleep.  Runs in the timer interrupt. */
+static void
+wake_sleepers (void) 
+{
+  bool preempt = false;
+
+  while (!heap_empty (&sleepers))
+    {
+      struct thread *t = heap_entry (heap_front (&sleepers),
+                                     struct thread, sleep_elem);
+      if (t->wakeup_tick > ticks)
+        break;
+      heap_pop (&sleepers);
+      thread_unblock (t);
+      if (thread_get_priority_any (t) > thread_get_priority ())
+        preempt = true;
+    }
+
+  next_wakeup = (heap_empty (&sleepers)
+                 ? INT64_MAX
+                 : heap_entry (heap_front (&sleepers), struct thread,
+                               sleep_elem)->wakeup_tick);
+  if (preempt)
+    intr_yield_on_return ();
+}
+
+/* Orders sleeping threads by wake-up tick. */
+static bool
+wakeup_less (const struct heap_elem *a_, const struct heap_elem *b_,
+             void *aux UNUSED) 
+{
+  const struct thread *a = heap_entry (a_, struct thread, sleep_elem);
+  const struct thread *b = heap_entry (b_, struct thread, sleep_elem);
+
+  return a->wakeup_tick < b->wakeup_tick;
 }
 
 /* Returns true if LOOPS iterations waits for more than one timer
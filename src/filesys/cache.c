@@ -0,0 +1,539 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/filesys.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* The buffer cache sits between the file system and fs_device.
+   All inode, directory and free map sectors are read and written
+   through it.  Dirty sectors are written back when they are
+   evicted, periodically by a write-behind thread, and when the
+   file system is shut down.
+
+   Locking: CACHE_LOCK protects which sector each entry holds and
+   the bookkeeping used for replacement.  Each entry's own lock
+   protects its data.  An entry that is pinned (PIN_CNT > 0) is
+   never chosen for replacement, so the data lock of an unpinned
+   entry is always free, and nobody waits for disk I/O while
+   holding CACHE_LOCK. */
+
+/* Ticks between two passes of the write-behind thread. */
+#define WRITE_BEHIND_TICKS TIMER_FREQ
+
+/* Number of read-ahead requests that may be queued.  Read-ahead
+   is only a hint, so requests beyond this are dropped. */
+#define READAHEAD_CNT 16
+
+/* Most sectors the read-ahead thread reads at once. */
+#define READAHEAD_BATCH 8
+
+/* Most sectors cache_flush() writes with one request. */
+#define FLUSH_RUN_MAX 16
+
+/* Most requests cache_flush() keeps in flight at once. */
+#define FLUSH_DEPTH 4
+
+/* Sector number for "no sector". */
+#define NO_SECTOR ((block_sector_t) -1)
+
+/* A cached sector. */
+struct cache_entry
+  {
+    /* Protected by cache_lock. */
+    block_sector_t sector;      /* Sector held, or NO_SECTOR. */
+    block_sector_t evicting;    /* Old sector being written back. */
+    int pin_cnt;                /* Number of users. */
+    bool accessed;              /* Used since the clock hand passed? */
+
+    /* Protected by LOCK. */
+    struct lock lock;           /* Serializes use of DATA. */
+    bool valid;                 /* DATA holds the sector's contents? */
+    bool dirty;                 /* DATA newer than the disk? */
+    uint8_t data[BLOCK_SECTOR_SIZE];
+  };
+
+static struct cache_entry cache[CACHE_SIZE];
+static struct lock cache_lock;
+static struct condition cache_changed;  /* An entry was unpinned or
+                                           written back. */
+static size_t clock_hand;               /* Next entry to consider. */
+
+/* Sectors waiting to be read ahead, a circular queue. */
+static block_sector_t readahead_queue[READAHEAD_CNT];
+static size_t readahead_head;
+static size_t readahead_cnt;
+static struct lock readahead_lock;
+static struct condition readahead_ready;
+
+/* A run of consecutive dirty sectors being written back by
+   cache_flush(). */
+struct flush_run
+  {
+    struct cache_entry *entries[FLUSH_RUN_MAX]; /* Pinned and locked. */
+    void *buffers[FLUSH_RUN_MAX];
+    size_t cnt;
+    struct block_request req;
+    struct semaphore done;
+  };
+
+static struct cache_entry *cache_get (block_sector_t, bool load,
+                                      bool *hitp);
+static void cache_put (struct cache_entry *, bool dirty);
+static struct cache_entry *lookup (block_sector_t);
+static struct cache_entry *cache_try_claim (block_sector_t);
+static struct cache_entry *claim (struct cache_entry *, block_sector_t);
+static struct cache_entry *lookup_next_dirty (block_sector_t);
+static bool start_run (struct flush_run *, block_sector_t *next);
+static void finish_run (struct flush_run *);
+static block_request_func request_done;
+static bool is_evicting (block_sector_t);
+static struct cache_entry *choose_victim (void);
+static thread_func write_behind NO_RETURN;
+static thread_func read_ahead NO_RETURN;
+
+/* Initializes the buffer cache and starts its helper threads. */
+void
+cache_init (void)
+{
+  size_t i;
+
+  lock_init (&cache_lock);
+  cond_init (&cache_changed);
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[i];
+      e->sector = NO_SECTOR;
+      e->evicting = NO_SECTOR;
+      e->pin_cnt = 0;
+      e->accessed = false;
+      lock_init (&e->lock);
+      e->valid = false;
+      e->dirty = false;
+    }
+  clock_hand = 0;
+
+  lock_init (&readahead_lock);
+  cond_init (&readahead_ready);
+  readahead_head = readahead_cnt = 0;
+
+  thread_create ("write-behind", PRI_DEFAULT, write_behind, NULL);
+  thread_create ("read-ahead", PRI_DEFAULT, read_ahead, NULL);
+}
+
+/* Reads SIZE bytes starting at byte OFS of SECTOR into BUFFER.
+   The bytes must lie within the sector. */
+void
+cache_read_at (block_sector_t sector, void *buffer, size_t size, size_t ofs)
+{
+  struct cache_entry *e;
+  bool hit;
+
+  ASSERT (ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, true, &hit);
+  block_record_cache (fs_device, hit);
+  memcpy (buffer, e->data + ofs, size);
+  cache_put (e, false);
+}
+
+/* Writes SIZE bytes from BUFFER starting at byte OFS of SECTOR.
+   The bytes must lie within the sector.  Overwriting a whole
+   sector does not read its old contents from disk. */
+void
+cache_write_at (block_sector_t sector, const void *buffer,
+                size_t size, size_t ofs)
+{
+  struct cache_entry *e;
+  bool hit;
+
+  ASSERT (ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, size < BLOCK_SECTOR_SIZE, &hit);
+  block_record_cache (fs_device, hit);
+  memcpy (e->data + ofs, buffer, size);
+  e->valid = true;
+  cache_put (e, true);
+}
+
+/* Asks for SECTOR to be brought into the cache in the
+   background.  Returns without waiting. */
+void
+cache_readahead (block_sector_t sector)
+{
+  lock_acquire (&readahead_lock);
+  if (readahead_cnt < READAHEAD_CNT)
+    {
+      readahead_queue[(readahead_head + readahead_cnt) % READAHEAD_CNT]
+        = sector;
+      readahead_cnt++;
+      cond_signal (&readahead_ready, &readahead_lock);
+    }
+  lock_release (&readahead_lock);
+}
+
+/* Writes every dirty sector back to disk.  Dirty sectors that
+   are next to each other on disk go out together, with one
+   request per run, and up to FLUSH_DEPTH runs are in flight at
+   once. */
+void
+cache_flush (void)
+{
+  struct flush_run runs[FLUSH_DEPTH];
+  size_t started = 0, finished = 0;
+  block_sector_t next = 0;
+
+  for (;;)
+    {
+      if (started - finished == FLUSH_DEPTH)
+        finish_run (&runs[finished++ % FLUSH_DEPTH]);
+      if (!start_run (&runs[started % FLUSH_DEPTH], &next))
+        break;
+      started++;
+    }
+  while (finished < started)
+    finish_run (&runs[finished++ % FLUSH_DEPTH]);
+}
+
+/* Starts writing back, as RUN, the lowest-numbered dirty sector
+   from *NEXT on and the dirty sectors that directly follow it,
+   and advances *NEXT past them.  Returns false if there are no
+   dirty sectors from *NEXT on. */
+static bool
+start_run (struct flush_run *run, block_sector_t *next)
+{
+  struct cache_entry *e;
+  size_t cnt, i;
+
+  do
+    {
+      /* Pin the run.  Entries' DIRTY flags are only hints until
+         we hold their locks. */
+      lock_acquire (&cache_lock);
+      e = lookup_next_dirty (*next);
+      cnt = 0;
+      while (e != NULL && e->dirty && cnt < FLUSH_RUN_MAX)
+        {
+          e->pin_cnt++;
+          run->entries[cnt++] = e;
+          e = lookup (e->sector + 1);
+        }
+      lock_release (&cache_lock);
+      if (cnt == 0)
+        return false;
+      *next = run->entries[cnt - 1]->sector + 1;
+
+      /* Nobody else blocks on an entry lock while holding
+         another, so taking them in sector order cannot
+         deadlock.  Keep the part of the run that is still dirty
+         and let go of the rest. */
+      for (i = 0; i < cnt; i++)
+        lock_acquire (&run->entries[i]->lock);
+      for (i = 0; i < cnt && run->entries[i]->valid
+                  && run->entries[i]->dirty; i++)
+        {
+          run->buffers[i] = run->entries[i]->data;
+          run->entries[i]->dirty = false;
+        }
+      run->cnt = i;
+      for (; i < cnt; i++)
+        cache_put (run->entries[i], false);
+    }
+  while (run->cnt == 0);
+
+  sema_init (&run->done, 0);
+  run->req.block = fs_device;
+  run->req.sector = run->entries[0]->sector;
+  run->req.cnt = run->cnt;
+  run->req.write = true;
+  run->req.buffers = run->buffers;
+  run->req.done = request_done;
+  run->req.aux = &run->done;
+  block_submit (&run->req);
+  return true;
+}
+
+/* Waits for the write started by start_run() for RUN to finish
+   and releases its entries. */
+static void
+finish_run (struct flush_run *run)
+{
+  size_t i;
+
+  sema_down (&run->done);
+  for (i = 0; i < run->cnt; i++)
+    cache_put (run->entries[i], false);
+}
+
+/* Completion function for our block requests, whose AUX is a
+   semaphore to up. */
+static void
+request_done (struct block_request *req)
+{
+  sema_up (req->aux);
+}
+
+/* Returns the entry for SECTOR, pinned and with its lock held.
+   If LOAD is true, the entry's data is valid on return.  If LOAD
+   is false, the caller is about to overwrite the whole sector and
+   must set the entry's VALID flag itself.  Stores into *HITP
+   whether SECTOR was already cached. */
+static struct cache_entry *
+cache_get (block_sector_t sector, bool load, bool *hitp)
+{
+  struct cache_entry *e;
+
+  lock_acquire (&cache_lock);
+  for (;;)
+    {
+      e = lookup (sector);
+      if (e != NULL)
+        {
+          /* Hit.  If the entry is still being filled, acquiring
+             its lock below waits for that to finish. */
+          e->pin_cnt++;
+          e->accessed = true;
+          lock_release (&cache_lock);
+          lock_acquire (&e->lock);
+          *hitp = true;
+          break;
+        }
+
+      /* Don't read SECTOR from disk while a newer copy of it is
+         still on its way out. */
+      if (!is_evicting (sector))
+        e = choose_victim ();
+      if (e == NULL)
+        {
+          cond_wait (&cache_changed, &cache_lock);
+          continue;
+        }
+
+      /* Miss. */
+      e = claim (e, sector);
+      *hitp = false;
+      break;
+    }
+
+  if (load && !e->valid)
+    {
+      block_read (fs_device, sector, e->data);
+      e->valid = true;
+    }
+  return e;
+}
+
+/* For read-ahead.  If SECTOR is not cached and an entry can be
+   taken over for it without waiting, returns that entry, pinned
+   and with its lock held, with its VALID flag false.  Otherwise,
+   returns a null pointer. */
+static struct cache_entry *
+cache_try_claim (block_sector_t sector)
+{
+  struct cache_entry *e = NULL;
+
+  lock_acquire (&cache_lock);
+  if (lookup (sector) == NULL && !is_evicting (sector))
+    e = choose_victim ();
+  if (e == NULL)
+    {
+      lock_release (&cache_lock);
+      return NULL;
+    }
+  return claim (e, sector);
+}
+
+/* Takes over unpinned entry E for SECTOR and returns it pinned
+   and with its lock held, which is free because E was not
+   pinned.  Writes back E's old sector first if it is dirty.
+   E's VALID flag is false on return.
+   Must be called with cache_lock held, which it releases. */
+static struct cache_entry *
+claim (struct cache_entry *e, block_sector_t sector)
+{
+  block_sector_t old_sector = e->sector;
+  bool write_back = old_sector != NO_SECTOR && e->valid && e->dirty;
+
+  lock_acquire (&e->lock);
+  e->sector = sector;
+  e->pin_cnt = 1;
+  e->accessed = true;
+  if (write_back)
+    e->evicting = old_sector;
+  lock_release (&cache_lock);
+
+  if (write_back)
+    {
+      block_write (fs_device, old_sector, e->data);
+      lock_acquire (&cache_lock);
+      e->evicting = NO_SECTOR;
+      cond_broadcast (&cache_changed, &cache_lock);
+      lock_release (&cache_lock);
+    }
+  e->valid = false;
+  e->dirty = false;
+  return e;
+}
+
+/* Releases entry E obtained from cache_get(), marking it dirty
+   if DIRTY is true. */
+static void
+cache_put (struct cache_entry *e, bool dirty)
+{
+  if (dirty)
+    e->dirty = true;
+  lock_release (&e->lock);
+
+  lock_acquire (&cache_lock);
+  if (--e->pin_cnt == 0)
+    cond_broadcast (&cache_changed, &cache_lock);
+  lock_release (&cache_lock);
+}
+
+/* Returns the entry holding SECTOR, or a null pointer.
+   Must be called with cache_lock held. */
+static struct cache_entry *
+lookup (block_sector_t sector)
+{
+  size_t i;
+
+  for (i = 0; i < CACHE_SIZE; i++)
+    if (cache[i].sector == sector)
+      return &cache[i];
+  return NULL;
+}
+
+/* Returns the entry holding the lowest-numbered sector that is
+   at least SECTOR and seems to be dirty, or a null pointer if
+   there is none.  The entry may no longer be dirty by the time
+   its lock is acquired.
+   Must be called with cache_lock held. */
+static struct cache_entry *
+lookup_next_dirty (block_sector_t sector)
+{
+  struct cache_entry *best = NULL;
+  size_t i;
+
+  for (i = 0; i < CACHE_SIZE; i++)
+    if (cache[i].sector != NO_SECTOR && cache[i].sector >= sector
+        && cache[i].dirty
+        && (best == NULL || cache[i].sector < best->sector))
+      best = &cache[i];
+  return best;
+}
+
+/* Returns true if an old copy of SECTOR is being written back.
+   Must be called with cache_lock held. */
+static bool
+is_evicting (block_sector_t sector)
+{
+  size_t i;
+
+  for (i = 0; i < CACHE_SIZE; i++)
+    if (cache[i].evicting == sector)
+      return true;
+  return false;
+}
+
+/* Picks an entry to replace with the clock algorithm, giving
+   every recently used entry a second chance.  Returns a null
+   pointer if every entry is pinned.
+   Must be called with cache_lock held. */
+static struct cache_entry *
+choose_victim (void)
+{
+  size_t i;
+
+  for (i = 0; i < 2 * CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[clock_hand];
+      clock_hand = (clock_hand + 1) % CACHE_SIZE;
+
+      if (e->pin_cnt > 0)
+        continue;
+      if (e->sector != NO_SECTOR && e->accessed)
+        {
+          e->accessed = false;
+          continue;
+        }
+      return e;
+    }
+  return NULL;
+}
+
+/* Write-behind thread.  Periodically flushes dirty sectors so
+   that a crash loses at most a few seconds of writes and so that
+   eviction rarely has to wait for a write. */
+static void
+write_behind (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_sleep (WRITE_BEHIND_TICKS);
+      cache_flush ();
+    }
+}
+
+/* Read-ahead thread.  Loads the sectors queued by
+   cache_readahead() into the cache, up to READAHEAD_BATCH at a
+   time, with all of their reads in flight together. */
+static void
+read_ahead (void *aux UNUSED)
+{
+  for (;;)
+    {
+      block_sector_t sectors[READAHEAD_BATCH];
+      struct cache_entry *entries[READAHEAD_BATCH];
+      struct block_request reqs[READAHEAD_BATCH];
+      void *buffers[READAHEAD_BATCH];
+      struct semaphore done;
+      size_t sector_cnt, cnt, i;
+
+      lock_acquire (&readahead_lock);
+      while (readahead_cnt == 0)
+        cond_wait (&readahead_ready, &readahead_lock);
+      for (sector_cnt = 0; readahead_cnt > 0 && sector_cnt < READAHEAD_BATCH;
+           sector_cnt++)
+        {
+          sectors[sector_cnt] = readahead_queue[readahead_head];
+          readahead_head = (readahead_head + 1) % READAHEAD_CNT;
+          readahead_cnt--;
+        }
+      lock_release (&readahead_lock);
+
+      /* Start reading each sector that is not cached yet.  We
+         hold several entry locks here, but we only ever take the
+         lock of an entry nobody else has pinned, so we never
+         block on one. */
+      sema_init (&done, 0);
+      cnt = 0;
+      for (i = 0; i < sector_cnt; i++)
+        {
+          struct cache_entry *e = cache_try_claim (sectors[i]);
+          struct block_request *req = &reqs[cnt];
+
+          if (e == NULL)
+            continue;
+          entries[cnt] = e;
+          buffers[cnt] = e->data;
+          req->block = fs_device;
+          req->sector = sectors[i];
+          req->cnt = 1;
+          req->write = false;
+          req->buffers = &buffers[cnt];
+          req->done = request_done;
+          req->aux = &done;
+          block_submit (req);
+          cnt++;
+        }
+
+      for (i = 0; i < cnt; i++)
+        sema_down (&done);
+      for (i = 0; i < cnt; i++)
+        {
+          entries[i]->valid = true;
+          cache_put (entries[i], false);
+        }
+    }
+}
@@ -1,12 +1,24 @@
 #include "filesys/directory.h"
 #include <stdio.h>
 #include <string.h>
+#include <hash.h>
 #include <list.h>
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
-/* A directory. */
+/* A directory.
+
+   Operations that look up an entry and then act on it hold the
+   directory inode's lock throughout (see inode_lock_dir()), so
+   that concurrent creates and removes in one directory see each
+   other's changes.
+
+   Every directory holds entries "." and "..", for itself and for
+   its parent, so that path names need no special cases for them.
+   The root directory is its own parent. */
 struct dir 
   {
     struct inode *inode;                /* Backing store. */
@@ -21,12 +33,87 @@ struct dir_entry
     bool in_use;                        /* In use or free? */
   };
 
+/* In-memory index of the entries of a directory, built the first
+   time the directory is searched and attached to its inode (see
+   inode_get_dir_index()).  It is kept up to date by dir_add() and
+   dir_remove() and, like the entries themselves, is protected by
+   the directory inode's lock. */
+struct dir_index
+  {
+    struct hash slots;                  /* Used slots, by name. */
+    struct list free_slots;             /* Unused slots. */
+  };
+
+/* A slot for an entry in a directory, as recorded in its index. */
+struct dir_slot
+  {
+    struct hash_elem hash_elem;         /* Element in slots, if used. */
+    struct list_elem list_elem;         /* Element in free_slots, if not. */
+    off_t ofs;                          /* Byte offset in directory. */
+    block_sector_t inode_sector;        /* Sector number of header. */
+    char name[NAME_MAX + 1];            /* Null terminated file name. */
+  };
+
+/* Number of entries in the dentry cache. */
+#define DENTRY_CNT 256
+
+/* A cached result of looking up a name in a directory.  The
+   dentry cache remembers both successful and failed lookups,
+   across all directories, including those whose inodes and
+   indexes are no longer in memory. */
+struct dentry
+  {
+    block_sector_t dir_sector;          /* Directory's inode sector. */
+    block_sector_t inode_sector;        /* Entry's inode, or 0 if the
+                                           name does not exist. */
+    bool valid;                         /* Does this entry hold anything? */
+    char name[NAME_MAX + 1];            /* Null terminated file name. */
+  };
+
+/* Direct-mapped dentry cache. */
+static struct dentry dentries[DENTRY_CNT];
+static struct lock dentries_lock;
+
+/* Changes whenever a directory is removed.  See path.c. */
+static unsigned generation;
+
+static struct dir_index *get_index (const struct dir *);
+static bool dentry_lookup (block_sector_t dir_sector, const char *name,
+                           block_sector_t *inode_sector);
+static void dentry_store (block_sector_t dir_sector, const char *name,
+                          block_sector_t inode_sector);
+static void dentry_invalidate_dir (block_sector_t dir_sector);
+static bool is_empty (struct inode *);
+
+/* Initializes the directory module. */
+void
+dir_init (void)
+{
+  lock_init (&dentries_lock);
+}
+
 /* Creates a directory with space for ENTRY_CNT entries in the
-   given SECTOR.  Returns true if successful, false on failure. */
+   given SECTOR, whose parent directory is in PARENT_SECTOR.
+   Returns true if successful, false on failure. */
 bool
-dir_create (block_sector_t sector, size_t entry_cnt)
+dir_create (block_sector_t sector, size_t entry_cnt,
+            block_sector_t parent_sector)
 {
-  return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
+  struct dir *dir;
+  bool success;
+
+  /* Forget what was cached about a directory previously at
+     SECTOR. */
+  dentry_invalidate_dir (sector);
+  if (!inode_create (sector, entry_cnt * sizeof (struct dir_entry), true))
+    return false;
+
+  dir = dir_open (inode_open (sector));
+  success = (dir != NULL
+             && dir_add (dir, ".", sector)
+             && dir_add (dir, "..", parent_sector));
+  dir_close (dir);
+  return success;
 }
 
 /* Opens and returns the directory for the given INODE, of which
@@ -87,17 +174,46 @@ dir_get_inode (struct dir *dir)
    If successful, returns true, sets *EP to the directory entry
    if EP is non-null, and sets *OFSP to the byte offset of the
    directory entry if OFSP is non-null.
-   otherwise, returns false and ignores EP and OFSP. */
+   otherwise, returns false and ignores EP and OFSP.
+   Must be called with DIR's inode locked. */
 static bool
 lookup (const struct dir *dir, const char *name,
         struct dir_entry *ep, off_t *ofsp) 
 {
+  struct dir_index *index;
   struct dir_entry e;
   size_t ofs;
   
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  if (strlen (name) > NAME_MAX)
+    return false;
+
+  index = get_index (dir);
+  if (index != NULL)
+    {
+      struct dir_slot key;
+      struct hash_elem *elem;
+      struct dir_slot *slot;
+
+      strlcpy (key.name, name, sizeof key.name);
+      elem = hash_find (&index->slots, &key.hash_elem);
+      if (elem == NULL)
+        return false;
+      slot = hash_entry (elem, struct dir_slot, hash_elem);
+      if (ep != NULL)
+        {
+          ep->inode_sector = slot->inode_sector;
+          strlcpy (ep->name, slot->name, sizeof ep->name);
+          ep->in_use = true;
+        }
+      if (ofsp != NULL)
+        *ofsp = slot->ofs;
+      return true;
+    }
+
+  /* No memory for an index: search the directory itself. */
   for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
        ofs += sizeof e) 
     if (e.in_use && !strcmp (name, e.name)) 
@@ -120,14 +236,29 @@ dir_lookup (const struct dir *dir, const char *name,
             struct inode **inode) 
 {
   struct dir_entry e;
+  block_sector_t sector;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  if (lookup (dir, name, &e, NULL))
-    *inode = inode_open (e.inode_sector);
+  /* Open the inode before letting go of the directory, so that
+     the file cannot be removed and its sectors reused in
+     between. */
+  *inode = NULL;
+  if (strlen (name) > NAME_MAX)
+    return false;
+
+  inode_lock_dir (dir->inode);
+  if (dentry_lookup (inode_get_inumber (dir->inode), name, &sector))
+    *inode = sector != 0 ? inode_open (sector) : NULL;
+  else if (lookup (dir, name, &e, NULL))
+    {
+      dentry_store (inode_get_inumber (dir->inode), name, e.inode_sector);
+      *inode = inode_open (e.inode_sector);
+    }
   else
-    *inode = NULL;
+    dentry_store (inode_get_inumber (dir->inode), name, 0);
+  inode_unlock_dir (dir->inode);
 
   return *inode != NULL;
 }
@@ -141,6 +272,8 @@ dir_lookup (const struct dir *dir, const char *name,
 bool
 dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 {
+  struct dir_index *index;
+  struct dir_slot *slot = NULL;
   struct dir_entry e;
   off_t ofs;
   bool success = false;
@@ -153,20 +286,40 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
     return false;
 
   /* Check that NAME is not in use. */
+  inode_lock_dir (dir->inode);
   if (lookup (dir, name, NULL, NULL))
     goto done;
 
   /* Set OFS to offset of free slot.
      If there are no free slots, then it will be set to the
-     current end-of-file.
-     
-     inode_read_at() will only return a short read at end of file.
-     Otherwise, we'd need to verify that we didn't get a short
-     read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (!e.in_use)
-      break;
+     current end-of-file. */
+  index = get_index (dir);
+  if (index != NULL)
+    {
+      if (!list_empty (&index->free_slots))
+        slot = list_entry (list_pop_front (&index->free_slots),
+                           struct dir_slot, list_elem);
+      else
+        {
+          slot = malloc (sizeof *slot);
+          if (slot == NULL)
+            goto done;
+          slot->ofs = inode_length (dir->inode);
+        }
+      ofs = slot->ofs;
+    }
+  else
+    {
+      /* inode_read_at() will only return a short read at end of
+         file.  Otherwise, we'd need to verify that we didn't get
+         a short read due to something intermittent such as low
+         memory. */
+      for (ofs = 0;
+           inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+           ofs += sizeof e) 
+        if (!e.in_use)
+          break;
+    }
 
   /* Write slot. */
   e.in_use = true;
@@ -174,16 +327,44 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
   e.inode_sector = inode_sector;
   success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
 
+  /* Record it in the index and the dentry cache. */
+  if (slot != NULL)
+    {
+      if (success)
+        {
+          slot->inode_sector = inode_sector;
+          strlcpy (slot->name, name, sizeof slot->name);
+          hash_insert (&index->slots, &slot->hash_elem);
+        }
+      else
+        list_push_front (&index->free_slots, &slot->list_elem);
+    }
+  if (success)
+    dentry_store (inode_get_inumber (dir->inode), name, inode_sector);
+
  done:
+  inode_unlock_dir (dir->inode);
   return success;
 }
 
+/* Returns a number that changes whenever a directory is removed,
+   so that a directory found by sector number can be checked not
+   to have been removed in the meantime. */
+unsigned
+dir_generation (void)
+{
+  return generation;
+}
+
 /* Removes any entry for NAME in DIR.
-   Returns true if successful, false on failure,
-   which occurs only if there is no file with the given NAME. */
+   Returns true if successful, false on failure, which occurs if
+   there is no file with the given NAME, if NAME is "." or "..",
+   or if NAME is a directory that is not empty or that is open
+   elsewhere. */
 bool
 dir_remove (struct dir *dir, const char *name) 
 {
+  struct dir_index *index;
   struct dir_entry e;
   struct inode *inode = NULL;
   bool success = false;
@@ -192,7 +373,11 @@ dir_remove (struct dir *dir, const char *name)
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  if (!strcmp (name, ".") || !strcmp (name, ".."))
+    return false;
+
   /* Find directory entry. */
+  inode_lock_dir (dir->inode);
   if (!lookup (dir, name, &e, &ofs))
     goto done;
 
@@ -201,23 +386,54 @@ dir_remove (struct dir *dir, const char *name)
   if (inode == NULL)
     goto done;
 
+  /* Only remove a directory that is empty and that nobody else
+     has open.  Change the generation before counting openers:
+     whoever opens the directory by sector from now on notices the
+     change, and whoever opened it before is counted. */
+  if (inode_is_dir (inode))
+    {
+      enum intr_level old_level = intr_disable ();
+      generation++;
+      intr_set_level (old_level);
+
+      if (inode_open_cnt (inode) > 1 || !is_empty (inode))
+        goto done;
+    }
+
   /* Erase directory entry. */
   e.in_use = false;
   if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) 
     goto done;
 
+  /* Update the index and the dentry cache. */
+  index = get_index (dir);
+  if (index != NULL)
+    {
+      struct dir_slot key;
+      struct hash_elem *elem;
+
+      strlcpy (key.name, name, sizeof key.name);
+      elem = hash_delete (&index->slots, &key.hash_elem);
+      if (elem != NULL)
+        list_push_front (&index->free_slots,
+                         &hash_entry (elem, struct dir_slot,
+                                      hash_elem)->list_elem);
+    }
+  dentry_store (inode_get_inumber (dir->inode), name, 0);
+
   /* Remove inode. */
   inode_remove (inode);
   success = true;
 
  done:
+  inode_unlock_dir (dir->inode);
   inode_close (inode);
   return success;
 }
 
 /* Reads the next directory entry in DIR and stores the name in
    NAME.  Returns true if successful, false if the directory
-   contains no more entries. */
+   contains no more entries.  Never returns "." or "..". */
 bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
@@ -226,7 +442,7 @@ dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
   while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
     {
       dir->pos += sizeof e;
-      if (e.in_use)
+      if (e.in_use && strcmp (e.name, ".") && strcmp (e.name, ".."))
         {
           strlcpy (name, e.name, NAME_MAX + 1);
           return true;
@@ -234,3 +450,188 @@ dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
     }
   return false;
 }
+
+/* Returns true if directory INODE holds no entries besides "."
+   and "..". */
+static bool
+is_empty (struct inode *inode)
+{
+  struct dir_entry e;
+  off_t ofs;
+
+  for (ofs = 0; inode_read_at (inode, &e, sizeof e, ofs) == sizeof e;
+       ofs += sizeof e)
+    if (e.in_use && strcmp (e.name, ".") && strcmp (e.name, ".."))
+      return false;
+  return true;
+}
+
+/* Returns the dir_slot that contains hash element E. */
+static struct dir_slot *
+hash_elem_to_slot (const struct hash_elem *e)
+{
+  return hash_entry (e, struct dir_slot, hash_elem);
+}
+
+static unsigned
+slot_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_string (hash_elem_to_slot (e)->name);
+}
+
+static bool
+slot_less (const struct hash_elem *a, const struct hash_elem *b,
+           void *aux UNUSED)
+{
+  return strcmp (hash_elem_to_slot (a)->name,
+                 hash_elem_to_slot (b)->name) < 0;
+}
+
+/* Frees the dir_slot that contains hash element E. */
+static void
+free_slot (struct hash_elem *e, void *aux UNUSED)
+{
+  free (hash_elem_to_slot (e));
+}
+
+/* Frees INDEX and all of its slots.  Does nothing if INDEX is
+   null. */
+void
+dir_index_destroy (struct dir_index *index)
+{
+  if (index == NULL)
+    return;
+  hash_destroy (&index->slots, free_slot);
+  while (!list_empty (&index->free_slots))
+    free (list_entry (list_pop_front (&index->free_slots),
+                      struct dir_slot, list_elem));
+  free (index);
+}
+
+/* Adds a slot at byte offset OFS for entry E to INDEX.
+   Returns false if memory allocation fails. */
+static bool
+index_add (struct dir_index *index, const struct dir_entry *e, off_t ofs)
+{
+  struct dir_slot *slot = malloc (sizeof *slot);
+  if (slot == NULL)
+    return false;
+
+  slot->ofs = ofs;
+  if (e->in_use)
+    {
+      slot->inode_sector = e->inode_sector;
+      strlcpy (slot->name, e->name, sizeof slot->name);
+      /* A duplicate name should not happen, but if it does,
+         leave its slot alone rather than reuse it. */
+      if (hash_insert (&index->slots, &slot->hash_elem) != NULL)
+        free (slot);
+    }
+  else
+    list_push_back (&index->free_slots, &slot->list_elem);
+  return true;
+}
+
+/* Returns the index of DIR's entries, reading them all to build
+   it if necessary.  Returns a null pointer if memory runs out.
+   Must be called with DIR's inode locked. */
+static struct dir_index *
+get_index (const struct dir *dir)
+{
+  struct dir_index *index = inode_get_dir_index (dir->inode);
+  struct dir_entry entries[16];
+  off_t ofs;
+
+  if (index != NULL)
+    return index;
+
+  index = malloc (sizeof *index);
+  if (index == NULL)
+    return NULL;
+  if (!hash_init (&index->slots, slot_hash, slot_less, NULL))
+    {
+      free (index);
+      return NULL;
+    }
+  list_init (&index->free_slots);
+
+  /* Read the entries many at a time. */
+  ofs = 0;
+  for (;;)
+    {
+      size_t cnt = (inode_read_at (dir->inode, entries, sizeof entries, ofs)
+                    / sizeof *entries);
+      size_t i;
+
+      if (cnt == 0)
+        break;
+      for (i = 0; i < cnt; i++, ofs += sizeof *entries)
+        if (!index_add (index, &entries[i], ofs))
+          {
+            dir_index_destroy (index);
+            return NULL;
+          }
+    }
+
+  inode_set_dir_index (dir->inode, index);
+  return index;
+}
+
+/* Returns the dentry cache entry for NAME in the directory whose
+   inode is at DIR_SECTOR. */
+static struct dentry *
+dentry_slot (block_sector_t dir_sector, const char *name)
+{
+  return &dentries[(hash_string (name) ^ hash_int (dir_sector))
+                   % DENTRY_CNT];
+}
+
+/* Looks up NAME in the directory whose inode is at DIR_SECTOR in
+   the dentry cache.  If it is there, stores the sector of its
+   inode, or 0 if no file by that name exists, into *INODE_SECTOR
+   and returns true.  Otherwise returns false. */
+static bool
+dentry_lookup (block_sector_t dir_sector, const char *name,
+               block_sector_t *inode_sector)
+{
+  struct dentry *d = dentry_slot (dir_sector, name);
+  bool found;
+
+  lock_acquire (&dentries_lock);
+  found = d->valid && d->dir_sector == dir_sector && !strcmp (d->name, name);
+  if (found)
+    *inode_sector = d->inode_sector;
+  lock_release (&dentries_lock);
+  return found;
+}
+
+/* Records in the dentry cache that NAME in the directory whose
+   inode is at DIR_SECTOR refers to the inode at INODE_SECTOR, or
+   does not exist if INODE_SECTOR is 0. */
+static void
+dentry_store (block_sector_t dir_sector, const char *name,
+              block_sector_t inode_sector)
+{
+  struct dentry *d = dentry_slot (dir_sector, name);
+
+  lock_acquire (&dentries_lock);
+  d->dir_sector = dir_sector;
+  d->inode_sector = inode_sector;
+  strlcpy (d->name, name, sizeof d->name);
+  d->valid = true;
+  lock_release (&dentries_lock);
+}
+
+/* Drops every dentry cache entry for the directory whose inode is
+   at DIR_SECTOR. */
+static void
+dentry_invalidate_dir (block_sector_t dir_sector)
+{
+  size_t i;
+
+  lock_acquire (&dentries_lock);
+  for (i = 0; i < DENTRY_CNT; i++)
+    if (dentries[i].dir_sector == dir_sector)
+      dentries[i].valid = false;
+  lock_release (&dentries_lock);
+}
@@ -3,32 +3,34 @@
 #include <stdio.h>
 #include <string.h>
 #include "threads/synch.h"
+#include "threads/thread.h"
+#include "filesys/cache.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
-
-/* Coarse file system lock */
-
+#include "filesys/path.h"
 
 /* Partition that contains the file system. */
 struct block *fs_device;
 
-struct lock filesys_lock;
-
 static void do_format (void);
+static block_sector_t dir_sector (struct dir *);
+static void discard_inode (block_sector_t, bool created);
+static bool names_dir (struct dir *, const char *name);
 
 /* Initializes the file system module.
    If FORMAT is true, reformats the file system. */
 void
 filesys_init (bool format) 
 {
-  lock_init(&filesys_lock);
   fs_device = block_get_role (BLOCK_FILESYS);
   if (fs_device == NULL)
     PANIC ("No file system device found, can't initialize file system.");
 
+  cache_init ();
   inode_init ();
+  dir_init ();
   free_map_init ();
 
   if (format) 
@@ -43,67 +45,162 @@ void
 filesys_done (void) 
 {
   free_map_close ();
+  cache_flush ();
+  block_wait_all ();
 }
 
 /* Creates a file named NAME with the given INITIAL_SIZE.
+   Returns true if successful, false otherwise.
+   Fails if a file named NAME already exists, if NAME ends in a
+   slash, or if internal memory allocation fails. */
+bool
+filesys_create (const char *name, off_t initial_size) 
+{
+  block_sector_t inode_sector = 0;
+  char file_name[NAME_MAX + 1];
+  bool is_dir;
+  struct dir *dir = path_open_parent (name, file_name, &is_dir);
+  bool created = false;
+  bool success = (dir != NULL
+                  && !is_dir
+                  && free_map_allocate_near (1, dir_sector (dir),
+                                             &inode_sector)
+                  && (created = inode_create (inode_sector, initial_size,
+                                              false))
+                  && dir_add (dir, file_name, inode_sector));
+  if (!success)
+    discard_inode (inode_sector, created);
+  dir_close (dir);
+
+  return success;
+}
+
+/* Creates a directory named NAME.
    Returns true if successful, false otherwise.
    Fails if a file named NAME already exists,
    or if internal memory allocation fails. */
 bool
-filesys_create (const char *name, off_t initial_size) 
+filesys_mkdir (const char *name)
 {
   block_sector_t inode_sector = 0;
-  struct dir *dir = dir_open_root ();
+  char dir_name[NAME_MAX + 1];
+  bool is_dir;
+  struct dir *dir = path_open_parent (name, dir_name, &is_dir);
+  bool created = false;
   bool success = (dir != NULL
-                  && free_map_allocate (1, &inode_sector)
-                  && inode_create (inode_sector, initial_size)
-                  && dir_add (dir, name, inode_sector));
-  if (!success && inode_sector != 0) 
-    free_map_release (inode_sector, 1);
+                  && free_map_allocate_near (1, dir_sector (dir),
+                                             &inode_sector)
+                  && (created = dir_create (inode_sector, 16,
+                                            dir_sector (dir)))
+                  && dir_add (dir, dir_name, inode_sector));
+  if (!success)
+    discard_inode (inode_sector, created);
   dir_close (dir);
 
   return success;
 }
 
-/* Opens the file with the given NAME.
+/* Opens the file or directory with the given NAME.
    Returns the new file if successful or a null pointer
    otherwise.
-   Fails if no file named NAME exists,
-   or if an internal memory allocation fails. */
+   Fails if no file named NAME exists, if NAME ends in a slash
+   but is not a directory, or if an internal memory allocation
+   fails. */
 struct file *
 filesys_open (const char *name)
 {
-  struct dir *dir = dir_open_root ();
+  char file_name[NAME_MAX + 1];
+  bool is_dir;
+  struct dir *dir = path_open_parent (name, file_name, &is_dir);
   struct inode *inode = NULL;
 
   if (dir != NULL)
-    dir_lookup (dir, name, &inode);
+    dir_lookup (dir, file_name, &inode);
   dir_close (dir);
 
+  /* A name ending in a slash must be a directory. */
+  if (inode != NULL && is_dir && !inode_is_dir (inode))
+    {
+      inode_close (inode);
+      return NULL;
+    }
   return file_open (inode);
 }
 
-/* Deletes the file named NAME.
+/* Deletes the file or empty directory named NAME.
    Returns true if successful, false on failure.
-   Fails if no file named NAME exists,
-   or if an internal memory allocation fails. */
+   Fails if no file named NAME exists, if NAME ends in a slash
+   but is not a directory, or if an internal memory allocation
+   fails. */
 bool
 filesys_remove (const char *name) 
 {
-  struct dir *dir = dir_open_root ();
-  bool success = dir != NULL && dir_remove (dir, name);
+  char file_name[NAME_MAX + 1];
+  bool is_dir;
+  struct dir *dir = path_open_parent (name, file_name, &is_dir);
+  bool success = (dir != NULL
+                  && (!is_dir || names_dir (dir, file_name))
+                  && dir_remove (dir, file_name));
   dir_close (dir); 
 
   return success;
 }
-
+
+/* Makes the directory named NAME the running thread's working
+   directory.  Returns true if successful, false on failure. */
+bool
+filesys_chdir (const char *name)
+{
+  struct thread *cur = thread_current ();
+  struct dir *dir = path_open_dir (name);
+
+  if (dir == NULL)
+    return false;
+  dir_close (cur->cwd);
+  cur->cwd = dir;
+  return true;
+}
+
+/* Returns the sector of DIR's inode. */
+static block_sector_t
+dir_sector (struct dir *dir)
+{
+  return inode_get_inumber (dir_get_inode (dir));
+}
+
+/* Gives back SECTOR, allocated for a new file or directory that
+   could not be added to its directory.  If CREATED, an inode was
+   written there, and its data blocks are freed too.  Does
+   nothing if SECTOR is 0. */
+static void
+discard_inode (block_sector_t sector, bool created)
+{
+  if (created)
+    inode_release (sector);
+  else if (sector != 0)
+    free_map_release (sector, 1);
+}
+
+/* Returns true if NAME in DIR is a directory. */
+static bool
+names_dir (struct dir *dir, const char *name)
+{
+  struct inode *inode = NULL;
+  bool is_dir;
+
+  dir_lookup (dir, name, &inode);
+  is_dir = inode != NULL && inode_is_dir (inode);
+  inode_close (inode);
+  return is_dir;
+}
+
 /* Formats the file system. */
 static void
 do_format (void)
 {
   printf ("Formatting file system...");
   free_map_create ();
-  if (!dir_create (ROOT_DIR_SECTOR, 16))
+  if (!dir_create (ROOT_DIR_SECTOR, 16, ROOT_DIR_SECTOR))
     PANIC ("root directory creation failed");
   free_map_close ();
   printf ("done.\n");
@@ -11,12 +11,12 @@
 /* Block device that contains the file system. */
 extern struct block *fs_device;
 
-extern struct lock filesys_lock;
-
 void filesys_init (bool format);
 void filesys_done (void);
 bool filesys_create (const char *name, off_t initial_size);
+bool filesys_mkdir (const char *name);
 struct file *filesys_open (const char *name);
 bool filesys_remove (const char *name);
+bool filesys_chdir (const char *name);
 
 #endif /* filesys/filesys.h */
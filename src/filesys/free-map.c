@@ -1,22 +1,73 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <hash.h>
+#include <list.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* The bitmap is the authoritative, on-disk record of which
+   sectors are in use.  So that allocation does not have to scan
+   it, every maximal run of free sectors is also kept in memory as
+   an extent, which can be found by its first sector, by the
+   sector just past its end, and by its size class. */
+
+/* Number of size classes.  Class K holds the extents of 2**K up
+   to 2**(K+1) - 1 sectors. */
+#define SIZE_CLASS_CNT 32
+
+/* Maximum number of extents examined in one size class when
+   looking for the best fit.  The smallest class that can fit a
+   request may also hold extents too small for it, so there the
+   scan goes on past this limit until it finds one that fits. */
+#define FIT_SCAN_LIMIT 16
+
+/* A run of free sectors. */
+struct extent
+  {
+    block_sector_t start;               /* First sector. */
+    size_t cnt;                         /* Number of sectors. */
+    struct hash_elem start_elem;        /* Element in extents_by_start. */
+    struct hash_elem end_elem;          /* Element in extents_by_end. */
+    struct list_elem size_elem;         /* Element in size_classes[]. */
+  };
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
+static struct hash extents_by_start; /* Free extents by first sector. */
+static struct hash extents_by_end;   /* Free extents by end sector. */
+static struct list size_classes[SIZE_CLASS_CNT];
+static struct lock free_map_lock;    /* Protects all of the above. */
+
+static hash_hash_func start_hash, end_hash;
+static hash_less_func start_less, end_less;
+static void build_extents (void);
+static void add_free (block_sector_t, size_t);
+static struct extent *find_fit (size_t, block_sector_t goal);
+static block_sector_t take (struct extent *, size_t);
 
 /* Initializes the free map. */
 void
 free_map_init (void) 
 {
+  size_t i;
+
   free_map = bitmap_create (block_size (fs_device));
   if (free_map == NULL)
     PANIC ("bitmap creation failed--file system device is too large");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  lock_init (&free_map_lock);
+
+  if (!hash_init (&extents_by_start, start_hash, start_less, NULL)
+      || !hash_init (&extents_by_end, end_hash, end_less, NULL))
+    PANIC ("free extent table creation failed");
+  for (i = 0; i < SIZE_CLASS_CNT; i++)
+    list_init (&size_classes[i]);
+  build_extents ();
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
@@ -27,26 +78,56 @@ free_map_init (void)
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  return free_map_allocate_near (cnt, 0, sectorp);
+}
+
+/* Like free_map_allocate(), but tries to place the sectors close
+   to GOAL: exactly at GOAL if a large enough free run starts
+   there, otherwise in the smallest free run that fits, preferring
+   runs near GOAL. */
+bool
+free_map_allocate_near (size_t cnt, block_sector_t goal,
+                        block_sector_t *sectorp)
+{
+  struct extent *e;
+  block_sector_t sector;
+
+  bool success = false;
+
+  ASSERT (cnt > 0);
+
+  lock_acquire (&free_map_lock);
+  e = find_fit (cnt, goal);
+  if (e != NULL)
     {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
+      sector = take (e, cnt);
+      bitmap_set_multiple (free_map, sector, cnt, true);
+      if (free_map_file != NULL
+          && !bitmap_write_range (free_map, free_map_file, sector, cnt))
+        {
+          bitmap_set_multiple (free_map, sector, cnt, false);
+          add_free (sector, cnt);
+        }
+      else
+        {
+          *sectorp = sector;
+          success = true;
+        }
     }
-  if (sector != BITMAP_ERROR)
-    *sectorp = sector;
-  return sector != BITMAP_ERROR;
+  lock_release (&free_map_lock);
+  return success;
 }
 
 /* Makes CNT sectors starting at SECTOR available for use. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  lock_acquire (&free_map_lock);
   ASSERT (bitmap_all (free_map, sector, cnt));
   bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  bitmap_write_range (free_map, free_map_file, sector, cnt);
+  add_free (sector, cnt);
+  lock_release (&free_map_lock);
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -58,6 +139,7 @@ free_map_open (void)
     PANIC ("can't open free map");
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  build_extents ();
 }
 
 /* Writes the free map to disk and closes the free map file. */
@@ -73,7 +155,7 @@ void
 free_map_create (void) 
 {
   /* Create inode. */
-  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map)))
+  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map), false))
     PANIC ("free map creation failed");
 
   /* Write bitmap to file. */
@@ -83,3 +165,245 @@ free_map_create (void)
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
 }
+
+/* Returns the size class of an extent of CNT sectors. */
+static int
+size_class (size_t cnt)
+{
+  ASSERT (cnt > 0);
+  return 31 - __builtin_clz (cnt);
+}
+
+/* Returns the extent that contains hash element E of
+   extents_by_start. */
+static struct extent *
+start_entry (const struct hash_elem *e)
+{
+  return hash_entry (e, struct extent, start_elem);
+}
+
+/* Returns the extent that contains hash element E of
+   extents_by_end. */
+static struct extent *
+end_entry (const struct hash_elem *e)
+{
+  return hash_entry (e, struct extent, end_elem);
+}
+
+static unsigned
+start_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (start_entry (e)->start);
+}
+
+static bool
+start_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return start_entry (a)->start < start_entry (b)->start;
+}
+
+static unsigned
+end_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct extent *x = end_entry (e);
+  return hash_int (x->start + x->cnt);
+}
+
+static bool
+end_less (const struct hash_elem *a, const struct hash_elem *b,
+          void *aux UNUSED)
+{
+  const struct extent *x = end_entry (a);
+  const struct extent *y = end_entry (b);
+  return x->start + x->cnt < y->start + y->cnt;
+}
+
+/* Adds E to the extent tables. */
+static void
+extent_link (struct extent *e)
+{
+  hash_insert (&extents_by_start, &e->start_elem);
+  hash_insert (&extents_by_end, &e->end_elem);
+  list_push_back (&size_classes[size_class (e->cnt)], &e->size_elem);
+}
+
+/* Removes E from the extent tables. */
+static void
+extent_unlink (struct extent *e)
+{
+  hash_delete (&extents_by_start, &e->start_elem);
+  hash_delete (&extents_by_end, &e->end_elem);
+  list_remove (&e->size_elem);
+}
+
+/* Returns the free extent that starts at SECTOR, or a null
+   pointer if there is none. */
+static struct extent *
+find_by_start (block_sector_t sector)
+{
+  struct extent key;
+  struct hash_elem *e;
+
+  key.start = sector;
+  e = hash_find (&extents_by_start, &key.start_elem);
+  return e != NULL ? start_entry (e) : NULL;
+}
+
+/* Returns the free extent that ends just before SECTOR, or a null
+   pointer if there is none. */
+static struct extent *
+find_by_end (block_sector_t sector)
+{
+  struct extent key;
+  struct hash_elem *e;
+
+  key.start = sector;
+  key.cnt = 0;
+  e = hash_find (&extents_by_end, &key.end_elem);
+  return e != NULL ? end_entry (e) : NULL;
+}
+
+/* Records the CNT sectors starting at SECTOR as a free extent,
+   merging it with the free extents on either side. */
+static void
+add_free (block_sector_t sector, size_t cnt)
+{
+  struct extent *prev = find_by_end (sector);
+  struct extent *next = find_by_start (sector + cnt);
+
+  if (prev != NULL)
+    {
+      extent_unlink (prev);
+      prev->cnt += cnt;
+      if (next != NULL)
+        {
+          extent_unlink (next);
+          prev->cnt += next->cnt;
+          free (next);
+        }
+      extent_link (prev);
+    }
+  else if (next != NULL)
+    {
+      extent_unlink (next);
+      next->start = sector;
+      next->cnt += cnt;
+      extent_link (next);
+    }
+  else
+    {
+      struct extent *e = malloc (sizeof *e);
+
+      /* Without memory the sectors stay free in the bitmap but
+         cannot be allocated until the free map is next read. */
+      if (e == NULL)
+        return;
+      e->start = sector;
+      e->cnt = cnt;
+      extent_link (e);
+    }
+}
+
+/* Returns the distance between sectors A and B. */
+static block_sector_t
+distance (block_sector_t a, block_sector_t b)
+{
+  return a > b ? a - b : b - a;
+}
+
+/* Returns a free extent of at least CNT sectors, chosen as
+   described for free_map_allocate_near(), or a null pointer if
+   none is found. */
+static struct extent *
+find_fit (size_t cnt, block_sector_t goal)
+{
+  struct extent *best;
+  int home = size_class (cnt);
+  int class;
+
+  best = find_by_start (goal);
+  if (best != NULL && best->cnt >= cnt)
+    return best;
+
+  for (class = home; class < SIZE_CLASS_CNT; class++)
+    {
+      struct list *list = &size_classes[class];
+      struct list_elem *elem;
+      int scanned = 0;
+
+      best = NULL;
+      for (elem = list_begin (list);
+           elem != list_end (list)
+             && (scanned < FIT_SCAN_LIMIT || (class == home && best == NULL));
+           elem = list_next (elem), scanned++)
+        {
+          struct extent *e = list_entry (elem, struct extent, size_elem);
+          if (e->cnt < cnt)
+            continue;
+          if (best == NULL
+              || e->cnt < best->cnt
+              || (e->cnt == best->cnt
+                  && distance (e->start, goal) < distance (best->start,
+                                                           goal)))
+            best = e;
+        }
+      if (best != NULL)
+        return best;
+    }
+  return NULL;
+}
+
+/* Removes the first CNT sectors from free extent E, which must
+   have at least that many, and returns the first of them. */
+static block_sector_t
+take (struct extent *e, size_t cnt)
+{
+  block_sector_t sector = e->start;
+
+  ASSERT (e->cnt >= cnt);
+
+  extent_unlink (e);
+  e->start += cnt;
+  e->cnt -= cnt;
+  if (e->cnt > 0)
+    extent_link (e);
+  else
+    free (e);
+  return sector;
+}
+
+/* Frees extent E, which has been removed from extents_by_end. */
+static void
+free_extent (struct hash_elem *e, void *aux UNUSED)
+{
+  free (start_entry (e));
+}
+
+/* Discards the extent tables and rebuilds them from the bitmap. */
+static void
+build_extents (void)
+{
+  size_t size = bitmap_size (free_map);
+  size_t start = 0;
+  size_t i;
+
+  hash_clear (&extents_by_end, NULL);
+  hash_clear (&extents_by_start, free_extent);
+  for (i = 0; i < SIZE_CLASS_CNT; i++)
+    list_init (&size_classes[i]);
+
+  while (start < size)
+    {
+      size_t end;
+
+      start = bitmap_scan (free_map, start, 1, false);
+      if (start == BITMAP_ERROR)
+        break;
+      end = bitmap_scan (free_map, start, 1, true);
+      if (end == BITMAP_ERROR)
+        end = size;
+      add_free (start, end - start);
+      start = end;
+    }
+}
@@ -1,23 +1,52 @@
 #include "filesys/inode.h"
+#include <hash.h>
 #include <list.h>
 #include <debug.h>
 #include <round.h>
 #include <string.h>
+#include "filesys/cache.h"
+#include "filesys/directory.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* Number of closed inodes kept in memory for quick reopening.
+   Set to 0 to free inodes as soon as they are closed. */
+#define INACTIVE_MAX 64
+
+/* Number of sector numbers held directly in the inode, and in
+   each indirect block. */
+#define DIRECT_CNT 123
+#define INDIRECT_CNT (BLOCK_SECTOR_SIZE / sizeof (block_sector_t))
+
+/* Most sectors of a single read asked for ahead of time. */
+#define READ_PREFETCH_MAX 8
+
+/* Largest file size supported, in sectors. */
+#define MAX_SECTORS (DIRECT_CNT + INDIRECT_CNT \
+                     + INDIRECT_CNT * INDIRECT_CNT)
+
 /* On-disk inode.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+
+   The first DIRECT_CNT data sectors are listed in DIRECT.  The
+   next INDIRECT_CNT are listed in the indirect block, and the
+   rest in the indirect blocks listed in the doubly indirect
+   block.  A sector number of 0 means that part of the file has
+   never been written; it reads as zeros.  Sector 0 holds the free
+   map inode, so it is never used for file data. */
 struct inode_disk
   {
-    block_sector_t start;               /* First data sector. */
+    block_sector_t direct[DIRECT_CNT];  /* Direct data sectors. */
+    block_sector_t indirect;            /* Indirect block. */
+    block_sector_t doubly_indirect;     /* Doubly indirect block. */
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[125];               /* Not used. */
+    uint32_t is_dir;                    /* Nonzero for a directory. */
   };
 
 /* Returns the number of sectors to allocate for an inode SIZE
@@ -28,49 +57,191 @@ bytes_to_sectors (off_t size)
   return DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
 }
 
-/* In-memory inode. */
+/* In-memory inode.
+
+   HASH_ELEM, INACTIVE_ELEM, OPEN_CNT, REMOVED and LOADING are
+   protected by inodes_lock.
+   DENY_WRITE_CNT and DATA are protected by RWLOCK, which readers
+   of the file hold for reading and writers hold for writing.
+   READ_END is not protected.  Concurrent readers may overwrite
+   each other's value, but it is only a hint for read-ahead, and
+   a stale value costs at most a missed or useless prefetch. */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem hash_elem;         /* Element in inodes. */
+    struct list_elem inactive_elem;     /* Element in inactive, if
+                                           OPEN_CNT is 0. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
+    bool loading;                       /* True while DATA is being read;
+                                           RWLOCK is held for writing. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+    off_t read_end;                     /* End of the last read, to
+                                           detect sequential reads. */
+    struct rwlock rwlock;               /* Orders reads and writes. */
+    struct lock dir_lock;               /* Serializes directory updates. */
+    struct dir_index *dir_index;        /* Directory's name index, or
+                                           null; see directory.c. */
     struct inode_disk data;             /* Inode content. */
   };
 
+/* State of a lookup that may allocate sectors. */
+struct allocation
+  {
+    block_sector_t goal;        /* Where to try to put the next sector. */
+    bool changed;               /* Was the on-disk inode modified? */
+  };
+
+/* Allocates a sector as close to ALLOC's goal as possible, fills
+   it with zeros and stores its number into *SECTORP.  The next
+   allocation will try to follow it.  Returns false if the disk is
+   full. */
+static bool
+allocate_zeroed (struct allocation *alloc, block_sector_t *sectorp)
+{
+  static char zeros[BLOCK_SECTOR_SIZE];
+
+  if (!free_map_allocate_near (1, alloc->goal, sectorp))
+    return false;
+  alloc->goal = *sectorp + 1;
+  cache_write_at (*sectorp, zeros, BLOCK_SECTOR_SIZE, 0);
+  return true;
+}
+
+/* Returns the sector number in *SLOT, a member of an on-disk
+   inode.  If it is 0 and ALLOC is non-null, first allocates a
+   zeroed sector for it.  Returns 0 if there is no sector and none
+   could be allocated. */
+static block_sector_t
+inode_slot (block_sector_t *slot, struct allocation *alloc)
+{
+  if (*slot == 0 && alloc != NULL && allocate_zeroed (alloc, slot))
+    alloc->changed = true;
+  return *slot;
+}
+
+/* Returns entry IDX of index block BLOCK.  If it is 0 and ALLOC
+   is non-null, first allocates a zeroed sector for it.  Returns 0
+   if there is no sector and none could be allocated. */
+static block_sector_t
+index_slot (block_sector_t block, size_t idx, struct allocation *alloc)
+{
+  block_sector_t sector;
+
+  cache_read_at (block, &sector, sizeof sector, idx * sizeof sector);
+  if (sector == 0 && alloc != NULL && allocate_zeroed (alloc, &sector))
+    cache_write_at (block, &sector, sizeof sector, idx * sizeof sector);
+  return sector;
+}
+
 /* Returns the block device sector that contains byte offset POS
-   within INODE.
-   Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
+   within the file described by DISK.  If ALLOC is non-null,
+   allocates that sector and any index blocks needed to reach it.
+   Returns 0 if that part of the file has no sector, or if ALLOC
+   is non-null and the disk is full or POS is beyond the largest
+   possible file. */
 static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) 
+byte_to_sector (struct inode_disk *disk, off_t pos,
+                struct allocation *alloc)
 {
-  ASSERT (inode != NULL);
-  if (pos < inode->data.length)
-    return inode->data.start + pos / BLOCK_SECTOR_SIZE;
-  else
-    return -1;
+  size_t idx = pos / BLOCK_SECTOR_SIZE;
+  block_sector_t block;
+
+  ASSERT (pos >= 0);
+
+  if (idx < DIRECT_CNT)
+    return inode_slot (&disk->direct[idx], alloc);
+  idx -= DIRECT_CNT;
+
+  if (idx < INDIRECT_CNT)
+    {
+      block = inode_slot (&disk->indirect, alloc);
+      return block != 0 ? index_slot (block, idx, alloc) : 0;
+    }
+  idx -= INDIRECT_CNT;
+
+  if (idx < INDIRECT_CNT * INDIRECT_CNT)
+    {
+      block = inode_slot (&disk->doubly_indirect, alloc);
+      if (block != 0)
+        block = index_slot (block, idx / INDIRECT_CNT, alloc);
+      return block != 0 ? index_slot (block, idx % INDIRECT_CNT, alloc) : 0;
+    }
+  return 0;
+}
+
+/* Releases SECTOR, which is LEVELS levels of index blocks above
+   file data, and every sector it refers to.  Does nothing if
+   SECTOR is 0. */
+static void
+release_tree (block_sector_t sector, int levels)
+{
+  if (sector == 0)
+    return;
+  if (levels > 0)
+    {
+      block_sector_t entries[INDIRECT_CNT];
+      size_t i;
+
+      cache_read_at (sector, entries, BLOCK_SECTOR_SIZE, 0);
+      for (i = 0; i < INDIRECT_CNT; i++)
+        release_tree (entries[i], levels - 1);
+    }
+  free_map_release (sector, 1);
+}
+
+/* Releases every data and index sector of the file described by
+   DISK. */
+static void
+deallocate (struct inode_disk *disk)
+{
+  size_t i;
+
+  for (i = 0; i < DIRECT_CNT; i++)
+    release_tree (disk->direct[i], 0);
+  release_tree (disk->indirect, 1);
+  release_tree (disk->doubly_indirect, 2);
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* In-memory inodes by sector, so that opening a single inode
+   twice returns the same `struct inode'.  Besides the open inodes
+   it holds up to INACTIVE_MAX closed ones, which can be reopened
+   without reading them again.  Their in-memory copy of the disk
+   inode stays current, since every change to it is also written
+   through to the buffer cache. */
+static struct hash inodes;
+static struct list inactive;         /* Closed inodes, least recently
+                                        closed first. */
+static size_t inactive_cnt;          /* Number of inodes in inactive. */
+static struct lock inodes_lock;      /* Protects all of the above. */
+
+static hash_hash_func inode_hash;
+static hash_less_func inode_less;
+static struct inode *find_inode (block_sector_t);
+static struct inode *open_existing (struct inode *);
+static struct inode *unlink_inactive (struct inode *);
+static void free_inode (struct inode *);
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  if (!hash_init (&inodes, inode_hash, inode_less, NULL))
+    PANIC ("inode table creation failed");
+  list_init (&inactive);
+  inactive_cnt = 0;
+  lock_init (&inodes_lock);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
    writes the new inode to sector SECTOR on the file system
-   device.
+   device.  The inode is for a directory if IS_DIR is true, for
+   an ordinary file otherwise.
    Returns true if successful.
    Returns false if memory or disk allocation fails. */
 bool
-inode_create (block_sector_t sector, off_t length)
+inode_create (block_sector_t sector, off_t length, bool is_dir)
 {
   struct inode_disk *disk_inode = NULL;
   bool success = false;
@@ -81,25 +252,54 @@ inode_create (block_sector_t sector, off_t length)
      one sector in size, and you should fix that. */
   ASSERT (sizeof *disk_inode == BLOCK_SECTOR_SIZE);
 
+  if (bytes_to_sectors (length) > MAX_SECTORS)
+    return false;
+
   disk_inode = calloc (1, sizeof *disk_inode);
   if (disk_inode != NULL)
     {
       size_t sectors = bytes_to_sectors (length);
+      struct allocation alloc;
+      size_t i;
+
       disk_inode->length = length;
       disk_inode->magic = INODE_MAGIC;
-      if (free_map_allocate (sectors, &disk_inode->start)) 
+      disk_inode->is_dir = is_dir;
+
+      /* Allocate the initial length up front, so that writes
+         within it never need to allocate.  The free map file
+         depends on this. */
+      alloc.goal = sector + 1;
+      alloc.changed = false;
+      success = true;
+      for (i = 0; i < sectors; i++)
+        if (byte_to_sector (disk_inode, i * BLOCK_SECTOR_SIZE,
+                            &alloc) == 0)
+          {
+            deallocate (disk_inode);
+            success = false;
+            break;
+          }
+
+      if (success)
         {
-          block_write (fs_device, sector, disk_inode);
-          if (sectors > 0) 
+          /* Drop any closed inode that SECTOR held before it was
+             freed and reused. */
+          struct inode *old;
+
+          lock_acquire (&inodes_lock);
+          old = find_inode (sector);
+          if (old != NULL)
             {
-              static char zeros[BLOCK_SECTOR_SIZE];
-              size_t i;
-              
-              for (i = 0; i < sectors; i++) 
-                block_write (fs_device, disk_inode->start + i, zeros);
+              ASSERT (old->open_cnt == 0);
+              unlink_inactive (old);
             }
-          success = true; 
-        } 
+          lock_release (&inodes_lock);
+          if (old != NULL)
+            free_inode (old);
+
+          cache_write_at (sector, disk_inode, BLOCK_SECTOR_SIZE, 0);
+        }
       free (disk_inode);
     }
   return success;
@@ -107,37 +307,68 @@ inode_create (block_sector_t sector, off_t length)
 
 /* Reads an inode from SECTOR
    and returns a `struct inode' that contains it.
-   Returns a null pointer if memory allocation fails. */
+   Returns a null pointer if memory allocation fails.
+
+   The disk inode is read without holding inodes_lock, so that
+   opening and closing other inodes need not wait for the disk.
+   Meanwhile the new inode is in the table marked as loading, and
+   other openers of SECTOR wait on its rwlock instead. */
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
-  struct inode *inode;
+  struct inode *inode, *old;
+
+  /* Check whether this inode is already in memory. */
+  lock_acquire (&inodes_lock);
+  inode = find_inode (sector);
+  if (inode != NULL)
+    return open_existing (inode);
+  lock_release (&inodes_lock);
 
-  /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  /* Allocate memory, making room by dropping closed inodes if
+     necessary. */
+  while ((inode = malloc (sizeof *inode)) == NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
-        {
-          inode_reopen (inode);
-          return inode; 
-        }
+      lock_acquire (&inodes_lock);
+      old = (list_empty (&inactive) ? NULL
+             : unlink_inactive (list_entry (list_front (&inactive),
+                                            struct inode, inactive_elem)));
+      lock_release (&inodes_lock);
+      if (old == NULL)
+        return NULL;
+      free_inode (old);
     }
 
-  /* Allocate memory. */
-  inode = malloc (sizeof *inode);
-  if (inode == NULL)
-    return NULL;
-
   /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
   inode->sector = sector;
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
+  inode->loading = true;
+  inode->read_end = 0;
+  rwlock_init (&inode->rwlock);
+  rwlock_acquire_write (&inode->rwlock);
+  lock_init (&inode->dir_lock);
+  inode->dir_index = NULL;
+
+  /* Make it visible, unless another opener got there first. */
+  lock_acquire (&inodes_lock);
+  old = find_inode (sector);
+  if (old != NULL)
+    {
+      rwlock_release_write (&inode->rwlock);
+      free (inode);
+      return open_existing (old);
+    }
+  hash_insert (&inodes, &inode->hash_elem);
+  lock_release (&inodes_lock);
+
+  cache_read_at (inode->sector, &inode->data, BLOCK_SECTOR_SIZE, 0);
+
+  lock_acquire (&inodes_lock);
+  inode->loading = false;
+  lock_release (&inodes_lock);
+  rwlock_release_write (&inode->rwlock);
   return inode;
 }
 
@@ -146,7 +377,12 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&inodes_lock);
+      ASSERT (inode->open_cnt > 0);
+      inode->open_cnt++;
+      lock_release (&inodes_lock);
+    }
   return inode;
 }
 
@@ -157,31 +393,71 @@ inode_get_inumber (const struct inode *inode)
   return inode->sector;
 }
 
+/* Returns true if INODE is a directory. */
+bool
+inode_is_dir (const struct inode *inode)
+{
+  return inode->data.is_dir != 0;
+}
+
+/* Returns the number of times INODE is open. */
+int
+inode_open_cnt (struct inode *inode)
+{
+  int open_cnt;
+
+  lock_acquire (&inodes_lock);
+  open_cnt = inode->open_cnt;
+  lock_release (&inodes_lock);
+  return open_cnt;
+}
+
 /* Closes INODE and writes it to disk.
-   If this was the last reference to INODE, frees its memory.
-   If INODE was also a removed inode, frees its blocks. */
+   If this was the last reference to INODE, moves it to the
+   inactive list, freeing the least recently closed inode if the
+   list is full.
+   If INODE was also a removed inode, frees its blocks and its
+   memory. */
 void
 inode_close (struct inode *inode) 
 {
+  struct inode *old = NULL;
+  bool removed;
+
   /* Ignore null pointer. */
   if (inode == NULL)
     return;
 
-  /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0)
+  lock_acquire (&inodes_lock);
+  ASSERT (inode->open_cnt > 0);
+  if (--inode->open_cnt > 0)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
- 
-      /* Deallocate blocks if removed. */
-      if (inode->removed) 
-        {
-          free_map_release (inode->sector, 1);
-          free_map_release (inode->data.start,
-                            bytes_to_sectors (inode->data.length)); 
-        }
+      lock_release (&inodes_lock);
+      return;
+    }
 
-      free (inode); 
+  removed = inode->removed;
+  if (removed)
+    hash_delete (&inodes, &inode->hash_elem);
+  else
+    {
+      list_push_back (&inactive, &inode->inactive_elem);
+      if (++inactive_cnt > INACTIVE_MAX)
+        old = unlink_inactive (list_entry (list_front (&inactive),
+                                           struct inode, inactive_elem));
+    }
+  lock_release (&inodes_lock);
+
+  if (old != NULL)
+    free_inode (old);
+
+  /* Deallocate blocks if removed.  Nobody else can find INODE any
+     more, so no locks are needed. */
+  if (removed)
+    {
+      free_map_release (inode->sector, 1);
+      deallocate (&inode->data);
+      free_inode (inode);
     }
 }
 
@@ -191,7 +467,34 @@ void
 inode_remove (struct inode *inode) 
 {
   ASSERT (inode != NULL);
+
+  lock_acquire (&inodes_lock);
   inode->removed = true;
+  lock_release (&inodes_lock);
+}
+
+/* Frees the inode at SECTOR and all of its data, without opening
+   it.  Undoes inode_create() for a file or directory that could
+   not be added to its directory, so nobody else may have it
+   open. */
+void
+inode_release (block_sector_t sector)
+{
+  struct inode_disk disk;
+  struct inode *old;
+
+  /* Drop the closed inode that dir_create() leaves behind. */
+  lock_acquire (&inodes_lock);
+  old = find_inode (sector);
+  if (old != NULL)
+    unlink_inactive (old);
+  lock_release (&inodes_lock);
+  if (old != NULL)
+    free_inode (old);
+
+  cache_read_at (sector, &disk, BLOCK_SECTOR_SIZE, 0);
+  deallocate (&disk);
+  free_map_release (sector, 1);
 }
 
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
@@ -202,12 +505,32 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
+  bool sequential;
+  off_t pos;
+  int cnt;
+
+  rwlock_acquire_read (&inode->rwlock);
+  sequential = offset == inode->read_end;
+
+  /* If the read spans several sectors, as when the loader reads a
+     page of an executable, ask for the later ones up front.  The
+     disk then fetches them together while we wait for the
+     first. */
+  for (pos = ROUND_UP (offset + 1, BLOCK_SECTOR_SIZE), cnt = 0;
+       pos < offset + size && pos < inode_length (inode)
+         && cnt < READ_PREFETCH_MAX;
+       pos += BLOCK_SECTOR_SIZE, cnt++)
+    {
+      block_sector_t sector = byte_to_sector (&inode->data, pos, NULL);
+      if (sector != 0)
+        cache_readahead (sector);
+    }
 
   while (size > 0) 
     {
       /* Disk sector to read, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      block_sector_t sector_idx = byte_to_sector (&inode->data, offset,
+                                                  NULL);
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
@@ -220,99 +543,100 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
-        }
-      else 
-        {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-          block_read (fs_device, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
-        }
+      if (sector_idx != 0)
+        cache_read_at (sector_idx, buffer + bytes_read, chunk_size,
+                       sector_ofs);
+      else
+        memset (buffer + bytes_read, 0, chunk_size);
       
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
+  inode->read_end = offset;
+
+  /* If the caller is reading through the file in order, fetch the
+     sector it will want next before it asks. */
+  if (sequential && bytes_read > 0)
+    {
+      off_t next = ROUND_UP (offset, BLOCK_SECTOR_SIZE);
+      if (next < inode_length (inode))
+        {
+          block_sector_t sector = byte_to_sector (&inode->data, next,
+                                                  NULL);
+          if (sector != 0)
+            cache_readahead (sector);
+        }
+    }
+  rwlock_release_read (&inode->rwlock);
 
   return bytes_read;
 }
 
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   less than SIZE if the disk fills up or the file would exceed
+   the largest supported size.  Writing past end of file extends
+   the inode; any gap before OFFSET reads back as zeros. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                 off_t offset) 
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
+  struct allocation alloc;
+  block_sector_t prev;
 
+  /* Writers hold the lock exclusively, since a write may allocate
+     sectors or extend the file. */
+  rwlock_acquire_write (&inode->rwlock);
   if (inode->deny_write_cnt)
-    return 0;
+    {
+      rwlock_release_write (&inode->rwlock);
+      return 0;
+    }
+
+  /* Place new sectors right after the one before OFFSET, so that
+     files written in order end up contiguous, or else near the
+     inode itself. */
+  prev = 0;
+  if (offset >= BLOCK_SECTOR_SIZE)
+    prev = byte_to_sector (&inode->data, offset - BLOCK_SECTOR_SIZE, NULL);
+  alloc.goal = prev != 0 ? prev + 1 : inode->sector + 1;
+  alloc.changed = false;
 
   while (size > 0) 
     {
-      /* Sector to write, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      /* Sector to write, allocating it if necessary, and starting
+         byte offset within sector. */
+      block_sector_t sector_idx = byte_to_sector (&inode->data, offset,
+                                                  &alloc);
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
-
-      /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
-      int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
-      int min_left = inode_left < sector_left ? inode_left : sector_left;
-
-      /* Number of bytes to actually write into this sector. */
-      int chunk_size = size < min_left ? size : min_left;
-      if (chunk_size <= 0)
+      if (sector_idx == 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
-        }
-      else 
-        {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
+      /* Number of bytes to actually write into this sector. */
+      int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
+      int chunk_size = size < sector_left ? size : sector_left;
 
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            block_read (fs_device, sector_idx, bounce);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
-        }
+      cache_write_at (sector_idx, buffer + bytes_written,
+                      chunk_size, sector_ofs);
 
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_written += chunk_size;
     }
-  free (bounce);
+
+  if (offset > inode->data.length)
+    {
+      inode->data.length = offset;
+      alloc.changed = true;
+    }
+  if (alloc.changed)
+    cache_write_at (inode->sector, &inode->data, BLOCK_SECTOR_SIZE, 0);
+  rwlock_release_write (&inode->rwlock);
 
   return bytes_written;
 }
@@ -322,8 +646,10 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 void
 inode_deny_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->rwlock);
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+  rwlock_release_write (&inode->rwlock);
 }
 
 /* Re-enables writes to INODE.
@@ -332,9 +658,45 @@ inode_deny_write (struct inode *inode)
 void
 inode_allow_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->rwlock);
   ASSERT (inode->deny_write_cnt > 0);
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
+  rwlock_release_write (&inode->rwlock);
+}
+
+/* Acquires INODE's directory lock, which keeps a directory's
+   entries consistent across a lookup and the update based on
+   it. */
+void
+inode_lock_dir (struct inode *inode)
+{
+  lock_acquire (&inode->dir_lock);
+}
+
+/* Releases INODE's directory lock. */
+void
+inode_unlock_dir (struct inode *inode)
+{
+  lock_release (&inode->dir_lock);
+}
+
+/* Returns the name index attached to directory inode INODE, or a
+   null pointer.  INODE must be locked with inode_lock_dir(). */
+struct dir_index *
+inode_get_dir_index (const struct inode *inode)
+{
+  return inode->dir_index;
+}
+
+/* Attaches name index INDEX to directory inode INODE, which must
+   be locked with inode_lock_dir().  INDEX is freed along with
+   INODE. */
+void
+inode_set_dir_index (struct inode *inode, struct dir_index *index)
+{
+  ASSERT (inode->dir_index == NULL);
+  inode->dir_index = index;
 }
 
 /* Returns the length, in bytes, of INODE's data. */
@@ -343,3 +705,85 @@ inode_length (const struct inode *inode)
 {
   return inode->data.length;
 }
+
+/* Returns the inode that contains hash element E. */
+static struct inode *
+hash_elem_to_inode (const struct hash_elem *e)
+{
+  return hash_entry (e, struct inode, hash_elem);
+}
+
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_elem_to_inode (e)->sector);
+}
+
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return hash_elem_to_inode (a)->sector < hash_elem_to_inode (b)->sector;
+}
+
+/* Returns the in-memory inode for SECTOR, open or not, or a null
+   pointer if there is none.
+   Must be called with inodes_lock held. */
+static struct inode *
+find_inode (block_sector_t sector)
+{
+  /* Static to keep the large struct inode off the stack; safe
+     because inodes_lock is held. */
+  static struct inode key;
+  struct hash_elem *e;
+
+  key.sector = sector;
+  e = hash_find (&inodes, &key.hash_elem);
+  return e != NULL ? hash_elem_to_inode (e) : NULL;
+}
+
+/* Opens INODE, which was found in the inode table, and returns
+   it.  If INODE is still being read, waits until it has been.
+   Must be called with inodes_lock held, which it releases. */
+static struct inode *
+open_existing (struct inode *inode)
+{
+  bool loading = inode->loading;
+
+  if (inode->open_cnt++ == 0)
+    {
+      list_remove (&inode->inactive_elem);
+      inactive_cnt--;
+    }
+  lock_release (&inodes_lock);
+
+  if (loading)
+    {
+      rwlock_acquire_read (&inode->rwlock);
+      rwlock_release_read (&inode->rwlock);
+    }
+  return inode;
+}
+
+/* Removes INODE, which must be closed, from the inactive list and
+   the inode table, and returns it.  The caller frees it with
+   free_inode() after releasing inodes_lock.
+   Must be called with inodes_lock held. */
+static struct inode *
+unlink_inactive (struct inode *inode)
+{
+  ASSERT (inode->open_cnt == 0);
+
+  list_remove (&inode->inactive_elem);
+  inactive_cnt--;
+  hash_delete (&inodes, &inode->hash_elem);
+  return inode;
+}
+
+/* Frees INODE, which nobody can find any more. */
+static void
+free_inode (struct inode *inode)
+{
+  dir_index_destroy (inode->dir_index);
+  free (inode);
+}
@@ -0,0 +1,241 @@
+#include "filesys/path.h"
+#include <hash.h>
+#include <string.h>
+#include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
+
+/* Path names are resolved one component at a time, starting at
+   the root directory for a path that begins with "/" and at the
+   running thread's working directory otherwise.  "." and ".."
+   are ordinary directory entries, so they need no special
+   handling here.
+
+   Each thread remembers which directory the directory part of a
+   few recently resolved paths led to, so that opening many files
+   in one deep directory walks down to it only once.  What is
+   remembered stays good until some directory is removed, which
+   changes dir_generation(). */
+
+/* Number of paths remembered per thread. */
+#define MEMO_CNT 8
+
+/* Longest directory part that is remembered. */
+#define MEMO_PATH_MAX 63
+
+/* A remembered path. */
+struct path_memo
+  {
+    bool valid;                         /* In use? */
+    unsigned generation;                /* dir_generation() when found. */
+    block_sector_t start_sector;        /* Directory the walk began in. */
+    block_sector_t sector;              /* Directory it ended in. */
+    char path[MEMO_PATH_MAX + 1];       /* Directory part of the path. */
+  };
+
+/* A thread's remembered paths, direct-mapped. */
+struct path_cache
+  {
+    struct path_memo memos[MEMO_CNT];
+  };
+
+static struct dir *walk (struct dir *, const char *path, size_t len);
+
+/* Opens the directory that is to hold the last component of
+   PATH and copies that component into NAME.  If PATH names the
+   root directory, NAME is ".".  Stores into *IS_DIRP whether PATH
+   ends in a slash, in which case the last component must be a
+   directory.  Returns the directory, which the caller must close,
+   or a null pointer if PATH is empty, a component is too long, or
+   the directory part of PATH does not name a directory. */
+struct dir *
+path_open_parent (const char *path, char name[NAME_MAX + 1], bool *is_dirp)
+{
+  struct thread *cur = thread_current ();
+  const char *first, *end;
+  struct dir *dir;
+
+  *is_dirp = false;
+  if (*path == '\0')
+    return NULL;
+
+  /* The last component lies between FIRST and END, before any
+     trailing slashes. */
+  end = path + strlen (path);
+  *is_dirp = end[-1] == '/';
+  while (end > path && end[-1] == '/')
+    end--;
+  first = end;
+  while (first > path && first[-1] != '/')
+    first--;
+  if (end - first > NAME_MAX)
+    return NULL;
+  if (first == end)
+    strlcpy (name, ".", NAME_MAX + 1);
+  else
+    strlcpy (name, first, end - first + 1);
+
+  if (*path == '/' || cur->cwd == NULL)
+    dir = dir_open_root ();
+  else
+    dir = dir_reopen (cur->cwd);
+  if (dir == NULL)
+    return NULL;
+  return walk (dir, path, first - path);
+}
+
+/* Opens and returns the directory named by PATH, or a null
+   pointer if there is none. */
+struct dir *
+path_open_dir (const char *path)
+{
+  char name[NAME_MAX + 1];
+  struct inode *inode = NULL;
+  struct dir *dir;
+  bool is_dir;
+
+  dir = path_open_parent (path, name, &is_dir);
+  if (dir == NULL)
+    return NULL;
+  dir_lookup (dir, name, &inode);
+  dir_close (dir);
+
+  if (inode != NULL && !inode_is_dir (inode))
+    {
+      inode_close (inode);
+      return NULL;
+    }
+  return dir_open (inode);
+}
+
+/* Frees CACHE, a thread's remembered paths.  Does nothing if
+   CACHE is null. */
+void
+path_cache_destroy (struct path_cache *cache)
+{
+  free (cache);
+}
+
+/* Returns the memo in which the running thread remembers where
+   the LEN-byte directory part PATH leads from the directory at
+   START_SECTOR, or a null pointer if that cannot be remembered. */
+static struct path_memo *
+get_memo (block_sector_t start_sector, const char *path, size_t len)
+{
+  struct thread *cur = thread_current ();
+
+  if (len > MEMO_PATH_MAX)
+    return NULL;
+  if (cur->path_cache == NULL)
+    {
+      cur->path_cache = calloc (1, sizeof *cur->path_cache);
+      if (cur->path_cache == NULL)
+        return NULL;
+    }
+  return &cur->path_cache->memos[(hash_bytes (path, len)
+                                  ^ hash_int (start_sector)) % MEMO_CNT];
+}
+
+/* Opens the directory remembered in MEMO for the LEN-byte
+   directory part PATH from the directory at START_SECTOR.
+   Returns a null pointer if MEMO remembers something else or
+   may be out of date. */
+static struct dir *
+open_memo (struct path_memo *memo, block_sector_t start_sector,
+           const char *path, size_t len)
+{
+  unsigned generation = dir_generation ();
+  struct dir *dir;
+
+  if (!memo->valid || memo->generation != generation
+      || memo->start_sector != start_sector
+      || memcmp (memo->path, path, len) || memo->path[len] != '\0')
+    return NULL;
+
+  /* A directory removed while we were opening it might have had
+     its sector reused. */
+  dir = dir_open (inode_open (memo->sector));
+  if (dir != NULL && dir_generation () != generation)
+    {
+      dir_close (dir);
+      memo->valid = false;
+      return NULL;
+    }
+  return dir;
+}
+
+/* Walks from DIR, which this function closes, down the LEN-byte
+   directory part PATH.  Returns the directory reached, or a null
+   pointer if a component does not exist or is not a directory. */
+static struct dir *
+walk (struct dir *dir, const char *path, size_t len)
+{
+  block_sector_t start_sector = inode_get_inumber (dir_get_inode (dir));
+  const char *end = path + len;
+  const char *p = path;
+  struct path_memo *memo;
+  unsigned generation;
+  struct dir *found;
+
+  /* Nothing to walk? */
+  while (p < end && *p == '/')
+    p++;
+  if (p == end)
+    return dir;
+
+  memo = get_memo (start_sector, path, len);
+  if (memo != NULL)
+    {
+      found = open_memo (memo, start_sector, path, len);
+      if (found != NULL)
+        {
+          dir_close (dir);
+          return found;
+        }
+    }
+
+  generation = dir_generation ();
+  while (p < end)
+    {
+      char name[NAME_MAX + 1];
+      size_t name_len = 0;
+      struct inode *inode;
+
+      while (p < end && *p != '/')
+        {
+          if (name_len == NAME_MAX)
+            {
+              dir_close (dir);
+              return NULL;
+            }
+          name[name_len++] = *p++;
+        }
+      name[name_len] = '\0';
+      while (p < end && *p == '/')
+        p++;
+
+      dir_lookup (dir, name, &inode);
+      dir_close (dir);
+      if (inode == NULL)
+        return NULL;
+      if (!inode_is_dir (inode))
+        {
+          inode_close (inode);
+          return NULL;
+        }
+      dir = dir_open (inode);
+      if (dir == NULL)
+        return NULL;
+    }
+
+  if (memo != NULL)
+    {
+      memo->valid = true;
+      memo->generation = generation;
+      memo->start_sector = start_sector;
+      memo->sector = inode_get_inumber (dir_get_inode (dir));
+      memcpy (memo->path, path, len);
+      memo->path[len] = '\0';
+    }
+  return dir;
+}
@@ -0,0 +1,13 @@
+#ifndef FILESYS_PATH_H
+#define FILESYS_PATH_H
+
+#include "filesys/directory.h"
+
+struct path_cache;
+
+struct dir *path_open_parent (const char *path, char name[NAME_MAX + 1],
+                              bool *is_dirp);
+struct dir *path_open_dir (const char *path);
+void path_cache_destroy (struct path_cache *);
+
+#endif /* filesys/path.h */
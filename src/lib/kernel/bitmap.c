@@ -68,6 +68,69 @@ last_mask (const struct bitmap *b)
   int last_bits = b->bit_cnt % ELEM_BITS;
   return last_bits ? ((elem_type) 1 << last_bits) - 1 : (elem_type) -1;
 }
+
+/* Returns a bit mask in which the bits of element IDX that
+   represent bits START through END - 1 of the bitmap are set to 1
+   and the rest are set to 0. */
+static inline elem_type
+range_mask (size_t idx, size_t start, size_t end)
+{
+  size_t first = idx * ELEM_BITS;
+  elem_type mask = (elem_type) -1;
+
+  if (start > first)
+    mask &= (elem_type) -1 << (start - first);
+  if (end < first + ELEM_BITS)
+    mask &= ((elem_type) 1 << (end - first)) - 1;
+  return mask;
+}
+
+/* Returns element IDX of B, inverted if VALUE is false, so that
+   the bits set to VALUE in B are set to 1 in the result. */
+static inline elem_type
+elem_value (const struct bitmap *b, size_t idx, bool value)
+{
+  return value ? b->bits[idx] : ~b->bits[idx];
+}
+
+/* Returns the number of bits set to 1 in X. */
+static inline size_t
+popcount (elem_type x)
+{
+  /* Add up adjacent bits, then pairs, then nibbles in parallel,
+     and finally sum the bytes with a multiply.  Written out since
+     __builtin_popcount() would need libgcc. */
+  x = x - ((x >> 1) & (elem_type) 0x5555555555555555ULL);
+  x = (x & (elem_type) 0x3333333333333333ULL)
+      + ((x >> 2) & (elem_type) 0x3333333333333333ULL);
+  x = (x + (x >> 4)) & (elem_type) 0x0f0f0f0f0f0f0f0fULL;
+  return (elem_type) (x * (elem_type) 0x0101010101010101ULL)
+         >> (ELEM_BITS - CHAR_BIT);
+}
+
+/* Returns the index of the first bit in B at or after START and
+   before END that is set to VALUE, or END if there is none.
+   Skips whole elements that contain no such bit. */
+static size_t
+find_next (const struct bitmap *b, size_t start, size_t end, bool value)
+{
+  size_t idx = elem_idx (start);
+  elem_type bits;
+
+  if (start >= end)
+    return end;
+
+  bits = elem_value (b, idx, value) & range_mask (idx, start, end);
+  while (bits == 0)
+    {
+      if (++idx * ELEM_BITS >= end)
+        return end;
+      bits = elem_value (b, idx, value);
+    }
+
+  start = idx * ELEM_BITS + __builtin_ctzl (bits);
+  return start < end ? start : end;
+}
 
 /* Creation and destruction. */
 
@@ -217,14 +280,26 @@ bitmap_set_all (struct bitmap *b, bool value)
 void
 bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
+  size_t idx, end;
   
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    bitmap_set (b, start + i, value);
+  if (cnt == 0)
+    return;
+  end = start + cnt;
+  for (idx = elem_idx (start); idx <= elem_idx (end - 1); idx++)
+    {
+      elem_type mask = range_mask (idx, start, end);
+
+      /* Each element is updated atomically, as in bitmap_mark()
+         and bitmap_reset(). */
+      if (value)
+        asm ("orl %1, %0" : "+m" (b->bits[idx]) : "r" (mask) : "cc");
+      else
+        asm ("andl %1, %0" : "+m" (b->bits[idx]) : "r" (~mask) : "cc");
+    }
 }
 
 /* Returns the number of bits in B between START and START + CNT,
@@ -232,16 +307,19 @@ bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value)
 size_t
 bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i, value_cnt;
+  size_t idx, end, value_cnt;
 
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
   value_cnt = 0;
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      value_cnt++;
+  if (cnt == 0)
+    return 0;
+  end = start + cnt;
+  for (idx = elem_idx (start); idx <= elem_idx (end - 1); idx++)
+    value_cnt += popcount (elem_value (b, idx, value)
+                          & range_mask (idx, start, end));
   return value_cnt;
 }
 
@@ -250,16 +328,11 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
-  
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      return true;
-  return false;
+  return find_next (b, start, start + cnt, value) < start + cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -298,13 +371,28 @@ bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
 
+  if (cnt == 0)
+    return start;
   if (cnt <= b->bit_cnt) 
     {
       size_t last = b->bit_cnt - cnt;
-      size_t i;
-      for (i = start; i <= last; i++)
-        if (!bitmap_contains (b, i, cnt, !value))
-          return i; 
+      size_t i = start;
+
+      /* Find a bit set to VALUE, then look for a bit set to !VALUE
+         among the CNT - 1 bits after it.  If there is one, no
+         group can start before it, so resume just past it. */
+      while (i <= last)
+        {
+          size_t bad;
+
+          i = find_next (b, i, last + 1, value);
+          if (i > last)
+            break;
+          bad = find_next (b, i, i + cnt, !value);
+          if (bad == i + cnt)
+            return i;
+          i = bad + 1;
+        }
     }
   return BITMAP_ERROR;
 }
@@ -358,6 +446,29 @@ bitmap_write (const struct bitmap *b, struct file *file)
   off_t size = byte_cnt (b->bit_cnt);
   return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Writes the part of B that holds the CNT bits starting at START
+   to FILE, at the offset that bitmap_write() would have written
+   it.  Return true if successful, false otherwise. */
+bool
+bitmap_write_range (const struct bitmap *b, struct file *file,
+                    size_t start, size_t cnt)
+{
+  size_t first, last;
+  off_t ofs, size;
+
+  ASSERT (b != NULL);
+  ASSERT (start <= b->bit_cnt);
+  ASSERT (cnt <= b->bit_cnt - start);
+
+  if (cnt == 0)
+    return true;
+  first = elem_idx (start);
+  last = elem_idx (start + cnt - 1);
+  ofs = first * sizeof (elem_type);
+  size = (last - first + 1) * sizeof (elem_type);
+  return file_write_at (file, b->bits + first, size, ofs) == size;
+}
 #endif /* FILESYS */
 
 /* Debugging. */
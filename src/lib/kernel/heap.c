@@ -0,0 +1,216 @@
+#include "heap.h"
+#include "../debug.h"
+
+/* Our pairing heap is a tree in which every element is "less"
+   than all of its descendants.  Each element keeps a pointer to
+   its leftmost child; the children of an element form a doubly
+   linked sibling list whose first member points back at the
+   parent instead of at a left sibling.  Melding two trees makes
+   the larger root the leftmost child of the smaller one; popping
+   the root melds its children back together in two passes,
+   pairwise from left to right and then from right to left, which
+   is what gives the O(log n) amortized bound. */
+
+static bool before (const struct heap *, const struct heap_elem *,
+                    const struct heap_elem *);
+static struct heap_elem *meld (struct heap *, struct heap_elem *,
+                               struct heap_elem *);
+static struct heap_elem *merge_pairs (struct heap *, struct heap_elem *);
+static void insert (struct heap *, struct heap_elem *);
+static void cut (struct heap_elem *);
+
+/* Initializes HEAP as an empty heap ordered by LESS given
+   auxiliary data AUX. */
+void
+heap_init (struct heap *heap, heap_less_func *less, void *aux)
+{
+  ASSERT (heap != NULL);
+  ASSERT (less != NULL);
+
+  heap->root = NULL;
+  heap->elem_cnt = 0;
+  heap->next_seq = 0;
+  heap->less = less;
+  heap->aux = aux;
+}
+
+/* Inserts ELEM into HEAP. */
+void
+heap_push (struct heap *heap, struct heap_elem *elem)
+{
+  ASSERT (heap != NULL);
+  ASSERT (elem != NULL);
+
+  elem->seq = heap->next_seq++;
+  insert (heap, elem);
+  heap->elem_cnt++;
+}
+
+/* Removes the front element from HEAP and returns it.
+   Undefined behavior if HEAP is empty before removal. */
+struct heap_elem *
+heap_pop (struct heap *heap)
+{
+  struct heap_elem *front;
+
+  ASSERT (!heap_empty (heap));
+
+  front = heap->root;
+  heap->root = merge_pairs (heap, front->child);
+  heap->elem_cnt--;
+  return front;
+}
+
+/* Removes ELEM, which must be in HEAP, from HEAP. */
+void
+heap_remove (struct heap *heap, struct heap_elem *elem)
+{
+  ASSERT (!heap_empty (heap));
+
+  if (elem == heap->root)
+    {
+      heap_pop (heap);
+      return;
+    }
+  cut (elem);
+  heap->root = meld (heap, heap->root, merge_pairs (heap, elem->child));
+  heap->elem_cnt--;
+}
+
+/* Restores the heap ordering after the value of ELEM, which must
+   be in HEAP, has changed in either direction.  ELEM keeps its
+   place among elements that compare equal to it. */
+void
+heap_update (struct heap *heap, struct heap_elem *elem)
+{
+  heap_remove (heap, elem);
+  insert (heap, elem);
+  heap->elem_cnt++;
+}
+
+/* Returns the front element of HEAP, or a null pointer if HEAP
+   is empty. */
+struct heap_elem *
+heap_front (const struct heap *heap)
+{
+  ASSERT (heap != NULL);
+  return heap->root;
+}
+
+/* Returns the number of elements in HEAP. */
+size_t
+heap_size (const struct heap *heap)
+{
+  ASSERT (heap != NULL);
+  return heap->elem_cnt;
+}
+
+/* Returns true if HEAP is empty, false otherwise. */
+bool
+heap_empty (const struct heap *heap)
+{
+  ASSERT (heap != NULL);
+  return heap->root == NULL;
+}
+
+/* Returns true if A must leave HEAP before B: A is less than B,
+   or they compare equal and A was pushed first. */
+static bool
+before (const struct heap *heap, const struct heap_elem *a,
+        const struct heap_elem *b)
+{
+  if (heap->less (a, b, heap->aux))
+    return true;
+  if (heap->less (b, a, heap->aux))
+    return false;
+  return (int) (a->seq - b->seq) < 0;
+}
+
+/* Melds the trees rooted at A and B, either of which may be
+   null, and returns the root of the result.  The sibling links
+   of the returned root are left for the caller to set. */
+static struct heap_elem *
+meld (struct heap *heap, struct heap_elem *a, struct heap_elem *b)
+{
+  if (a == NULL)
+    return b;
+  if (b == NULL)
+    return a;
+  if (before (heap, b, a))
+    {
+      struct heap_elem *tmp = a;
+      a = b;
+      b = tmp;
+    }
+
+  /* B becomes A's leftmost child. */
+  b->prev = a;
+  b->next = a->child;
+  if (a->child != NULL)
+    a->child->prev = b;
+  a->child = b;
+  return a;
+}
+
+/* Melds the sibling list starting at FIRST into a single tree
+   and returns its root, or a null pointer if FIRST is null. */
+static struct heap_elem *
+merge_pairs (struct heap *heap, struct heap_elem *first)
+{
+  struct heap_elem *pairs = NULL;
+  struct heap_elem *root = NULL;
+
+  /* Left to right: meld adjacent pairs, stacking the results
+     through their `next' members so that the second pass sees
+     them right to left. */
+  while (first != NULL)
+    {
+      struct heap_elem *a = first;
+      struct heap_elem *b = a->next;
+
+      first = b != NULL ? b->next : NULL;
+      a->prev = a->next = NULL;
+      if (b != NULL)
+        b->prev = b->next = NULL;
+
+      a = meld (heap, a, b);
+      a->next = pairs;
+      pairs = a;
+    }
+
+  /* Right to left: meld each pair into the accumulated tree. */
+  while (pairs != NULL)
+    {
+      struct heap_elem *p = pairs;
+      pairs = p->next;
+      p->next = NULL;
+      root = meld (heap, root, p);
+    }
+
+  if (root != NULL)
+    root->prev = root->next = NULL;
+  return root;
+}
+
+/* Melds ELEM, as a single-element tree, into HEAP without
+   touching its sequence number or the element count. */
+static void
+insert (struct heap *heap, struct heap_elem *elem)
+{
+  elem->child = elem->prev = elem->next = NULL;
+  heap->root = meld (heap, heap->root, elem);
+}
+
+/* Unlinks ELEM, which must not be a root, together with its
+   subtree from its parent's list of children. */
+static void
+cut (struct heap_elem *elem)
+{
+  if (elem->prev->child == elem)
+    elem->prev->child = elem->next;
+  else
+    elem->prev->next = elem->next;
+  if (elem->next != NULL)
+    elem->next->prev = elem->prev;
+  elem->prev = elem->next = NULL;
+}
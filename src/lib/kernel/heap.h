@@ -0,0 +1,79 @@
+#ifndef __LIB_KERNEL_HEAP_H
+#define __LIB_KERNEL_HEAP_H
+
+/* Priority queue.
+
+   This is a pairing heap.  Like the linked list in list.h it
+   does not use dynamic allocation: each structure that can be in
+   a heap embeds a struct heap_elem member, and the heap_entry
+   macro converts from a struct heap_elem back to the structure
+   that contains it.
+
+   The element at the front of the heap is the one that is "less"
+   than every other element according to the heap's
+   heap_less_func.  To get the largest element at the front, as
+   for a priority queue of threads, supply a function that
+   returns true when A is greater than B.
+
+   Elements that compare equal leave the heap in the order they
+   were pushed, so a heap may stand in for a FIFO wait queue.
+
+   Costs, amortized: heap_push() and heap_front() are O(1);
+   heap_pop(), heap_remove() and heap_update() are O(log n).  None
+   of the operations allocate memory, so all of them may be used
+   with interrupts disabled or from an interrupt handler. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Heap element. */
+struct heap_elem
+  {
+    struct heap_elem *child;    /* Leftmost child. */
+    struct heap_elem *next;     /* Right sibling. */
+    struct heap_elem *prev;     /* Left sibling, or parent if leftmost. */
+    unsigned seq;               /* Push order, breaks ties. */
+  };
+
+/* Converts pointer to heap element HEAP_ELEM into a pointer to
+   the structure that HEAP_ELEM is embedded inside.  Supply the
+   name of the outer structure STRUCT and the member name MEMBER
+   of the heap element. */
+#define heap_entry(HEAP_ELEM, STRUCT, MEMBER)           \
+        ((STRUCT *) ((uint8_t *) &(HEAP_ELEM)->child    \
+                     - offsetof (STRUCT, MEMBER.child)))
+
+/* Compares the value of two heap elements A and B, given
+   auxiliary data AUX.  Returns true if A should come out of the
+   heap before B. */
+typedef bool heap_less_func (const struct heap_elem *a,
+                             const struct heap_elem *b,
+                             void *aux);
+
+/* Heap. */
+struct heap
+  {
+    struct heap_elem *root;     /* Front element, or null if empty. */
+    size_t elem_cnt;            /* Number of elements. */
+    unsigned next_seq;          /* Sequence number for next push. */
+    heap_less_func *less;       /* Comparison function. */
+    void *aux;                  /* Auxiliary data for `less'. */
+  };
+
+void heap_init (struct heap *, heap_less_func *, void *aux);
+
+/* Insertion and removal. */
+void heap_push (struct heap *, struct heap_elem *);
+struct heap_elem *heap_pop (struct heap *);
+void heap_remove (struct heap *, struct heap_elem *);
+void heap_update (struct heap *, struct heap_elem *);
+
+/* Heap elements. */
+struct heap_elem *heap_front (const struct heap *);
+
+/* Heap properties. */
+size_t heap_size (const struct heap *);
+bool heap_empty (const struct heap *);
+
+#endif /* lib/kernel/heap.h */
@@ -0,0 +1,237 @@
+/* Test and benchmark program for lib/kernel/bitmap.c.
+
+   Checks bitmap_scan(), bitmap_count(), bitmap_contains() and
+   bitmap_set_multiple(), which work on whole elements, against
+   the bit-at-a-time versions they replaced, and compares the
+   speed of the two on 1M-bit bitmaps at several fill ratios.
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <bitmap.h>
+#include <debug.h>
+#include <inttypes.h>
+#include <random.h>
+#include <stdio.h>
+#include "devices/timer.h"
+#include "threads/test.h"
+
+/* Number of bits in the benchmark bitmaps. */
+#define BIT_CNT (1024 * 1024)
+
+/* Number of successive scans timed per group size. */
+#define SCAN_CNT 64
+
+/* Percentage of bits set in each benchmark bitmap. */
+static const int fill_percents[] = {0, 25, 50, 75, 90, 99, 100};
+
+/* Group sizes to scan for. */
+static const size_t group_sizes[] = {1, 8, 64};
+
+#define ARRAY_CNT(A) (sizeof (A) / sizeof *(A))
+
+static void check_random (void);
+static void benchmark (int fill_percent);
+
+static size_t old_count (const struct bitmap *, size_t start, size_t cnt,
+                         bool value);
+static bool old_contains (const struct bitmap *, size_t start, size_t cnt,
+                          bool value);
+static size_t old_scan (const struct bitmap *, size_t start, size_t cnt,
+                        bool value);
+static void old_set_multiple (struct bitmap *, size_t start, size_t cnt,
+                              bool value);
+
+/* Test and benchmark the bitmap implementation. */
+void
+test (void)
+{
+  size_t i;
+
+  printf ("checking against bit-at-a-time versions...");
+  check_random ();
+  printf (" done\n");
+
+  for (i = 0; i < ARRAY_CNT (fill_percents); i++)
+    benchmark (fill_percents[i]);
+
+  printf ("bitmap: PASS\n");
+}
+
+/* Fills B so that about FILL_PERCENT percent of its bits are
+   set. */
+static void
+fill (struct bitmap *b, int fill_percent)
+{
+  size_t i;
+
+  bitmap_set_all (b, false);
+  for (i = 0; i < bitmap_size (b); i++)
+    if ((int) (random_ulong () % 100) < fill_percent)
+      bitmap_mark (b, i);
+}
+
+/* Compares the new and old operations on small random bitmaps
+   and ranges, which reach every alignment within an element. */
+static void
+check_random (void)
+{
+  int iter;
+
+  for (iter = 0; iter < 2000; iter++)
+    {
+      size_t size = random_ulong () % 300;
+      struct bitmap *b = bitmap_create (size);
+      struct bitmap *ref = bitmap_create (size);
+      size_t i;
+      int op;
+
+      ASSERT (b != NULL && ref != NULL);
+      fill (b, random_ulong () % 101);
+      for (i = 0; i < size; i++)
+        bitmap_set (ref, i, bitmap_test (b, i));
+
+      for (op = 0; op < 20; op++)
+        {
+          size_t start = random_ulong () % (size + 1);
+          size_t cnt = random_ulong () % (size - start + 1);
+          size_t group = random_ulong () % 40;
+          bool value = random_ulong () % 2;
+
+          ASSERT (bitmap_count (b, start, cnt, value)
+                  == old_count (b, start, cnt, value));
+          ASSERT (bitmap_contains (b, start, cnt, value)
+                  == old_contains (b, start, cnt, value));
+          ASSERT (bitmap_scan (b, start, group, value)
+                  == old_scan (b, start, group, value));
+
+          bitmap_set_multiple (b, start, cnt, value);
+          old_set_multiple (ref, start, cnt, value);
+          for (i = 0; i < size; i++)
+            ASSERT (bitmap_test (b, i) == bitmap_test (ref, i));
+        }
+
+      bitmap_destroy (b);
+      bitmap_destroy (ref);
+    }
+}
+
+/* Times a series of SCAN_CNT scans for free groups of GROUP bits
+   in B, each starting just past the previous find, using SCAN.
+   Stores the index of the last group found into *LASTP and
+   returns the elapsed timer ticks. */
+static int64_t
+time_scans (const struct bitmap *b, size_t group,
+            size_t (*scan) (const struct bitmap *, size_t, size_t, bool),
+            size_t *lastp)
+{
+  int64_t start = timer_ticks ();
+  size_t idx = 0;
+  size_t last = BITMAP_ERROR;
+  int i;
+
+  for (i = 0; i < SCAN_CNT && idx <= bitmap_size (b); i++)
+    {
+      last = scan (b, idx, group, false);
+      if (last == BITMAP_ERROR)
+        break;
+      idx = last + 1;
+    }
+  *lastp = last;
+  return timer_elapsed (start);
+}
+
+/* Compares old and new operations on a bitmap of BIT_CNT bits
+   with FILL_PERCENT percent of them set. */
+static void
+benchmark (int fill_percent)
+{
+  struct bitmap *b = bitmap_create (BIT_CNT);
+  int64_t start, old_ticks, new_ticks;
+  size_t old_result, new_result;
+  size_t i;
+
+  ASSERT (b != NULL);
+  fill (b, fill_percent);
+  printf ("%3d%% full:\n", fill_percent);
+
+  for (i = 0; i < ARRAY_CNT (group_sizes); i++)
+    {
+      old_ticks = time_scans (b, group_sizes[i], old_scan, &old_result);
+      new_ticks = time_scans (b, group_sizes[i], bitmap_scan, &new_result);
+      ASSERT (old_result == new_result);
+      printf ("  scan for %2zu: %6"PRId64" ticks old, %6"PRId64" ticks new\n",
+              group_sizes[i], old_ticks, new_ticks);
+    }
+
+  start = timer_ticks ();
+  old_result = old_count (b, 0, BIT_CNT, true);
+  old_ticks = timer_elapsed (start);
+  start = timer_ticks ();
+  new_result = bitmap_count (b, 0, BIT_CNT, true);
+  new_ticks = timer_elapsed (start);
+  ASSERT (old_result == new_result);
+  printf ("  count:        %6"PRId64" ticks old, %6"PRId64" ticks new\n",
+          old_ticks, new_ticks);
+
+  start = timer_ticks ();
+  old_set_multiple (b, 0, BIT_CNT, false);
+  old_ticks = timer_elapsed (start);
+  start = timer_ticks ();
+  bitmap_set_multiple (b, 0, BIT_CNT, false);
+  new_ticks = timer_elapsed (start);
+  printf ("  set_multiple: %6"PRId64" ticks old, %6"PRId64" ticks new\n",
+          old_ticks, new_ticks);
+
+  bitmap_destroy (b);
+}
+
+/* The bit-at-a-time implementations, as they were before. */
+
+static size_t
+old_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
+{
+  size_t i, value_cnt;
+
+  value_cnt = 0;
+  for (i = 0; i < cnt; i++)
+    if (bitmap_test (b, start + i) == value)
+      value_cnt++;
+  return value_cnt;
+}
+
+static bool
+old_contains (const struct bitmap *b, size_t start, size_t cnt, bool value)
+{
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    if (bitmap_test (b, start + i) == value)
+      return true;
+  return false;
+}
+
+static size_t
+old_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
+{
+  if (cnt <= bitmap_size (b))
+    {
+      size_t last = bitmap_size (b) - cnt;
+      size_t i;
+      for (i = start; i <= last; i++)
+        if (!old_contains (b, i, cnt, !value))
+          return i;
+    }
+  return BITMAP_ERROR;
+}
+
+static void
+old_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value)
+{
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    bitmap_set (b, start + i, value);
+}
@@ -0,0 +1,29 @@
+/* Checks that pread() and pwrite() transfer data at the position
+   they are given and leave the file position unchanged. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/userprog/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  char buf[50];
+  int handle;
+
+  CHECK (create ("test.txt", sizeof sample - 1), "create \"test.txt\"");
+  CHECK ((handle = open ("test.txt")) > 1, "open \"test.txt\"");
+  CHECK (write (handle, sample, 10) == 10, "write 10 bytes");
+
+  CHECK (pwrite (handle, sample + 100, sizeof buf, 100) == (int) sizeof buf,
+         "pwrite 50 bytes at 100");
+  CHECK (tell (handle) == 10, "tell() = 10 after pwrite");
+
+  CHECK (pread (handle, buf, sizeof buf, 100) == (int) sizeof buf,
+         "pread 50 bytes at 100");
+  if (memcmp (buf, sample + 100, sizeof buf))
+    fail ("pread() returned wrong data");
+  CHECK (tell (handle) == 10, "tell() = 10 after pread");
+}
@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(pread-tell) begin
+(pread-tell) create "test.txt"
+(pread-tell) open "test.txt"
+(pread-tell) write 10 bytes
+(pread-tell) pwrite 50 bytes at 100
+(pread-tell) tell() = 10 after pwrite
+(pread-tell) pread 50 bytes at 100
+(pread-tell) tell() = 10 after pread
+(pread-tell) end
+pread-tell: exit(0)
+EOF
+pass;
@@ -0,0 +1,39 @@
+/* Calls readv() near the end of a file, so that the second
+   buffer is filled only in part.  readv() must stop there,
+   leaving the third buffer untouched. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/userprog/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  const size_t size = sizeof sample - 1;
+  char buf[3][8];
+  const char *bytes = (const char *) buf;
+  struct iovec iov[3];
+  int handle, byte_cnt;
+  size_t i;
+
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  seek (handle, size - 10);
+
+  memset (buf, 'x', sizeof buf);
+  for (i = 0; i < 3; i++)
+    {
+      iov[i].iov_base = buf[i];
+      iov[i].iov_len = sizeof buf[i];
+    }
+  byte_cnt = readv (handle, iov, 3);
+  if (byte_cnt != 10)
+    fail ("readv() returned %d instead of 10", byte_cnt);
+  if (memcmp (bytes, sample + size - 10, 10))
+    fail ("readv() returned wrong data");
+  for (i = 10; i < sizeof buf; i++)
+    if (bytes[i] != 'x')
+      fail ("readv() wrote byte %zu past end of file", i);
+  msg ("readv stopped at end of file");
+}
@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(readv-eof) begin
+(readv-eof) open "sample.txt"
+(readv-eof) readv stopped at end of file
+(readv-eof) end
+readv-eof: exit(0)
+EOF
+pass;
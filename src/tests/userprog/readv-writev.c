@@ -0,0 +1,48 @@
+/* Writes a file with writev() from several buffers of different
+   sizes, then reads it back with readv() into a differently
+   split set of buffers and checks the data. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/userprog/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  const size_t size = sizeof sample - 1;
+  char head[50], middle[1], tail[sizeof sample];
+  struct iovec out[3], in[3];
+  int handle, byte_cnt;
+
+  CHECK (create ("test.txt", size), "create \"test.txt\"");
+  CHECK ((handle = open ("test.txt")) > 1, "open \"test.txt\"");
+
+  out[0].iov_base = sample;
+  out[0].iov_len = 10;
+  out[1].iov_base = sample + 10;
+  out[1].iov_len = 100;
+  out[2].iov_base = sample + 110;
+  out[2].iov_len = size - 110;
+  byte_cnt = writev (handle, out, 3);
+  if (byte_cnt != (int) size)
+    fail ("writev() returned %d instead of %zu", byte_cnt, size);
+  msg ("writev \"test.txt\"");
+
+  seek (handle, 0);
+  in[0].iov_base = head;
+  in[0].iov_len = sizeof head;
+  in[1].iov_base = middle;
+  in[1].iov_len = sizeof middle;
+  in[2].iov_base = tail;
+  in[2].iov_len = size - sizeof head - sizeof middle;
+  byte_cnt = readv (handle, in, 3);
+  if (byte_cnt != (int) size)
+    fail ("readv() returned %d instead of %zu", byte_cnt, size);
+  if (memcmp (head, sample, sizeof head)
+      || memcmp (middle, sample + sizeof head, sizeof middle)
+      || memcmp (tail, sample + sizeof head + sizeof middle, in[2].iov_len))
+    fail ("readv() returned wrong data");
+  msg ("readv \"test.txt\"");
+}
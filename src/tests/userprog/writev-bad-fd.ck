@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF', <<'EOF']);
+(writev-bad-fd) begin
+(writev-bad-fd) end
+writev-bad-fd: exit(0)
+EOF
+(writev-bad-fd) begin
+writev-bad-fd: exit(-1)
+EOF
+pass;
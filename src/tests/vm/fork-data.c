@@ -0,0 +1,39 @@
+/* Forks a child and checks that it sees the data, bss and stack
+   contents its parent had at the time of the fork. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char data[] = "initialized data";
+static char bss[2 * 4096];
+
+void
+test_main (void)
+{
+  char stack[] = "stack data";
+  pid_t pid;
+  size_t i;
+
+  for (i = 0; i < sizeof bss; i++)
+    bss[i] = i % 251;
+
+  msg ("fork");
+  pid = fork ();
+  if (pid == 0)
+    {
+      if (strcmp (data, "initialized data"))
+        fail ("child sees wrong initialized data");
+      for (i = 0; i < sizeof bss; i++)
+        if ((bss[i] & 0xff) != i % 251)
+          fail ("byte %zu of bss has value %02hhx in child", i, bss[i]);
+      if (strcmp (stack, "stack data"))
+        fail ("child sees wrong stack data");
+      msg ("child sees parent's data");
+      exit (81);
+    }
+  if (pid == -1)
+    fail ("fork failed");
+  msg ("wait(fork()) = %d", wait (pid));
+}
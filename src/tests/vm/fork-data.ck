@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(fork-data) begin
+(fork-data) fork
+(fork-data) child sees parent's data
+fork-data: exit(81)
+(fork-data) wait(fork()) = 81
+(fork-data) end
+fork-data: exit(0)
+EOF
+pass;
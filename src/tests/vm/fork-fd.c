@@ -0,0 +1,52 @@
+/* Forks a child with a file open, and checks that the child
+   inherits the file and its position, and that reading and
+   closing it in the child does not affect the parent's copy. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/vm/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+/* Reads 20 bytes from HANDLE and checks them against SAMPLE at
+   offset 10. */
+static void
+check_read (int handle)
+{
+  char buf[20];
+
+  if (read (handle, buf, sizeof buf) != (int) sizeof buf)
+    fail ("read returned wrong count");
+  if (memcmp (buf, sample + 10, sizeof buf))
+    fail ("read returned wrong data");
+}
+
+void
+test_main (void)
+{
+  char buf[10];
+  int handle;
+  pid_t pid;
+
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK (read (handle, buf, sizeof buf) == (int) sizeof buf,
+         "read 10 bytes");
+
+  msg ("fork");
+  pid = fork ();
+  if (pid == 0)
+    {
+      CHECK (tell (handle) == 10, "child: tell() = 10");
+      check_read (handle);
+      CHECK (tell (handle) == 30, "child: tell() = 30 after read");
+      close (handle);
+      exit (83);
+    }
+  if (pid == -1)
+    fail ("fork failed");
+
+  msg ("wait(fork()) = %d", wait (pid));
+  CHECK (tell (handle) == 10, "parent: tell() = 10");
+  check_read (handle);
+  CHECK (tell (handle) == 30, "parent: tell() = 30 after read");
+}
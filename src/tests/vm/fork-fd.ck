@@ -0,0 +1,19 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(fork-fd) begin
+(fork-fd) open "sample.txt"
+(fork-fd) read 10 bytes
+(fork-fd) fork
+(fork-fd) child: tell() = 10
+(fork-fd) child: tell() = 30 after read
+fork-fd: exit(83)
+(fork-fd) wait(fork()) = 83
+(fork-fd) parent: tell() = 10
+(fork-fd) parent: tell() = 30 after read
+(fork-fd) end
+fork-fd: exit(0)
+EOF
+pass;
@@ -0,0 +1,57 @@
+/* Forks a child, then has parent and child both write to their
+   copies of the same pages, and checks that neither sees the
+   other's writes. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[3 * 4096];
+
+/* Fails unless every byte of BUF and STACK is VALUE. */
+static void
+check_filled (const char *who, const char *stack, size_t size, char value)
+{
+  size_t i;
+
+  for (i = 0; i < sizeof buf; i++)
+    if (buf[i] != value)
+      fail ("%s: byte %zu of buf is %c (should be %c)",
+            who, i, buf[i], value);
+  for (i = 0; i < size; i++)
+    if (stack[i] != value)
+      fail ("%s: byte %zu of stack is %c (should be %c)",
+            who, i, stack[i], value);
+}
+
+void
+test_main (void)
+{
+  char stack[128];
+  pid_t pid;
+
+  memset (buf, 'a', sizeof buf);
+  memset (stack, 'a', sizeof stack);
+
+  msg ("fork");
+  pid = fork ();
+  if (pid == 0)
+    {
+      /* The parent may or may not have written its copy yet. */
+      check_filled ("child", stack, sizeof stack, 'a');
+      memset (buf, 'c', sizeof buf);
+      memset (stack, 'c', sizeof stack);
+      check_filled ("child", stack, sizeof stack, 'c');
+      msg ("child's copy is private");
+      exit (82);
+    }
+  if (pid == -1)
+    fail ("fork failed");
+
+  memset (buf, 'p', sizeof buf);
+  memset (stack, 'p', sizeof stack);
+  msg ("wait(fork()) = %d", wait (pid));
+  check_filled ("parent", stack, sizeof stack, 'p');
+  msg ("parent's copy is private");
+}
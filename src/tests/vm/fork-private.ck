@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(fork-private) begin
+(fork-private) fork
+(fork-private) child's copy is private
+fork-private: exit(82)
+(fork-private) wait(fork()) = 82
+(fork-private) parent's copy is private
+(fork-private) end
+fork-private: exit(0)
+EOF
+pass;
@@ -2,6 +2,10 @@
 #include "threads/scheduler.h"
 #include "threads/thread.h"
 
+#if PRI_MAX - PRI_MIN + 1 != READY_QUEUE_CNT
+#error READY_QUEUE_CNT must cover every priority level
+#endif
+
 static scheduler_type type;
 
 void set_scheduler(scheduler_type t){
@@ -12,36 +16,112 @@ scheduler_type get_scheduler_type(void){
     return type;
 }
 
-struct thread* next_thread_to_run(struct list *ready_list){
+/* Returns the run queue T belongs in.  The naive scheduler keeps
+   everybody in a single FIFO. */
+static int queue_key(struct thread *t){
+    if(type == SCHEDULER_NAIVE){
+        return PRI_MIN;
+    }
+    return thread_get_priority_any(t);
+}
 
-    ASSERT(!list_empty(ready_list));
+/* Returns the index of the highest set bit in OCCUPIED, which
+   must be non-zero.  Split into halves so that only 32-bit
+   builtins are used; we do not link against libgcc. */
+static int highest_queue(uint64_t occupied){
+    uint32_t high = occupied >> 32;
+    if(high != 0){
+        return 32 + 31 - __builtin_clz(high);
+    }
+    return 31 - __builtin_clz((uint32_t)occupied);
+}
 
-    switch(type){
+void ready_queue_init(struct ready_queue *rq){
+    for(int i = 0; i < READY_QUEUE_CNT; ++i){
+        list_init(&rq->queues[i]);
+    }
+    rq->occupied = 0;
+    rq->size = 0;
+}
 
-        case SCHEDULER_NAIVE: {
-            return list_entry (list_pop_front (ready_list), struct thread, elem);
-            break;
-        }
-        case SCHEDULER_ADVANCED: {
-        }
-        case SCHEDULER_PRIORITY: {
-            struct thread* thread_to_operate = NULL;
-            int min_priority = PRI_MIN - 1; 
-            for (struct list_elem* e = list_begin (ready_list); e != list_end (ready_list); e = list_next (e)){
-                struct thread *t = list_entry (e, struct thread, elem);
-                int real_priority = thread_get_priority_any(t);
-                if( real_priority > min_priority){
-                    min_priority = real_priority;
-                    thread_to_operate = t;
-                }
-            }
-            ASSERT(thread_to_operate != NULL);
-            list_remove(&thread_to_operate->elem);
-
-            return thread_to_operate;
-            break;
+/* Appends T to the back of the queue for its current priority.
+   Must be called with interrupts off. */
+void ready_queue_push(struct ready_queue *rq, struct thread *t){
+    int key = queue_key(t);
+    ASSERT(key >= PRI_MIN && key <= PRI_MAX);
+
+    t->ready_priority = key;
+    list_push_back(&rq->queues[key], &t->elem);
+    rq->occupied |= (uint64_t)1 << key;
+    rq->size++;
+}
+
+/* Removes T, which must be queued in RQ.
+   Must be called with interrupts off. */
+void ready_queue_remove(struct ready_queue *rq, struct thread *t){
+    int key = t->ready_priority;
+
+    list_remove(&t->elem);
+    if(list_empty(&rq->queues[key])){
+        rq->occupied &= ~((uint64_t)1 << key);
+    }
+    rq->size--;
+}
+
+/* Moves T to the queue matching its current priority, after a
+   donation or recalculation changed it.  T keeps its place if
+   its priority did not actually change.
+   Must be called with interrupts off. */
+void ready_queue_update(struct ready_queue *rq, struct thread *t){
+    if(t->ready_priority == queue_key(t)){
+        return;
+    }
+    ready_queue_remove(rq, t);
+    ready_queue_push(rq, t);
+}
+
+bool ready_queue_empty(const struct ready_queue *rq){
+    return rq->occupied == 0;
+}
+
+size_t ready_queue_size(const struct ready_queue *rq){
+    return rq->size;
+}
+
+/* Calls ACTION on every thread in RQ and then puts each back in
+   the queue for the priority ACTION left it with.  Threads keep
+   their relative order within each queue.  Costs O(n) in the
+   number of ready threads only.
+   Must be called with interrupts off. */
+void ready_queue_recompute(struct ready_queue *rq,
+                           void (*action)(struct thread *, void *), void *aux){
+    struct list all;
+
+    list_init(&all);
+    for(int key = READY_QUEUE_CNT - 1; key >= PRI_MIN; --key){
+        struct list *q = &rq->queues[key];
+        if(!list_empty(q)){
+            list_splice(list_end(&all), list_begin(q), list_end(q));
         }
     }
-    ASSERT(0);
-    return NULL;
-}
\ No newline at end of file
+    rq->occupied = 0;
+    rq->size = 0;
+
+    while(!list_empty(&all)){
+        struct thread *t = list_entry(list_pop_front(&all), struct thread, elem);
+        action(t, aux);
+        ready_queue_push(rq, t);
+    }
+}
+
+/* Removes and returns the first thread of the highest non-empty
+   queue. */
+struct thread* next_thread_to_run(struct ready_queue *rq){
+
+    ASSERT(!ready_queue_empty(rq));
+
+    int key = highest_queue(rq->occupied);
+    struct thread *t = list_entry(list_front(&rq->queues[key]), struct thread, elem);
+    ready_queue_remove(rq, t);
+    return t;
+}
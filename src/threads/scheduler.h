@@ -3,6 +3,11 @@
 
 #include <debug.h>
 #include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct thread;
 
 typedef enum scheduler_type{
     SCHEDULER_PRIORITY,
@@ -10,8 +15,30 @@ typedef enum scheduler_type{
     SCHEDULER_NAIVE
 } scheduler_type ;
 
+/* One run queue per priority level, PRI_MIN through PRI_MAX. */
+#define READY_QUEUE_CNT 64
+
+/* Ready threads, bucketed by priority.  Bit P of `occupied' is
+   set exactly when queues[P] is non-empty, so the highest ready
+   priority is a single find-last-set and picking the next thread
+   does not depend on how many threads are ready. */
+struct ready_queue{
+    struct list queues[READY_QUEUE_CNT];    /* FIFO per priority. */
+    uint64_t occupied;                      /* Non-empty queues. */
+    size_t size;                            /* Total ready threads. */
+};
+
 void set_scheduler(scheduler_type);
 scheduler_type get_scheduler_type(void);
-struct thread* next_thread_to_run(struct list *ready_list);
 
-#endif
\ No newline at end of file
+void ready_queue_init(struct ready_queue *);
+void ready_queue_push(struct ready_queue *, struct thread *);
+void ready_queue_remove(struct ready_queue *, struct thread *);
+void ready_queue_update(struct ready_queue *, struct thread *);
+bool ready_queue_empty(const struct ready_queue *);
+size_t ready_queue_size(const struct ready_queue *);
+void ready_queue_recompute(struct ready_queue *,
+                           void (*action)(struct thread *, void *), void *aux);
+struct thread* next_thread_to_run(struct ready_queue *);
+
+#endif
@@ -32,6 +32,10 @@
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 
+static heap_less_func sema_waiter_less;
+static heap_less_func cond_waiter_less;
+static void take_lock (struct lock *);
+
 /* Initializes semaphore SEMA to VALUE.  A semaphore is a
    nonnegative integer along with two atomic operators for
    manipulating it:
@@ -47,7 +51,7 @@ sema_init (struct semaphore *sema, unsigned value)
   ASSERT (sema != NULL);
 
   sema->value = value;
-  list_init (&sema->waiters);
+  heap_init (&sema->waiters, sema_waiter_less, NULL);
 }
 
 /* Down or "P" operation on a semaphore.  Waits for SEMA's value
@@ -68,7 +72,9 @@ sema_down (struct semaphore *sema)
   old_level = intr_disable ();
   while (sema->value == 0) 
     {
-      list_push_back (&sema->waiters, &thread_current ()->elem);
+      struct thread *cur = thread_current ();
+      cur->wait_sema = sema;
+      heap_push (&sema->waiters, &cur->wait_elem);
       thread_block ();
     }
   sema->value--;
@@ -114,27 +120,18 @@ sema_up (struct semaphore *sema)
 
   old_level = intr_disable ();
   struct thread* thread_to_operate = NULL;
-  if (!list_empty (&sema->waiters)){
-    // thread_unblock (list_entry (list_pop_front (&sema->waiters), struct thread, elem));
-    int min_priority = PRI_MIN - 1; 
-
-    for (struct list_elem* e = list_begin (&sema->waiters); e != list_end (&sema->waiters); e = list_next (e)){
-        struct thread *t = list_entry (e, struct thread, elem);
-        int priority = thread_get_priority_any(t);
-        if( priority > min_priority){
-            min_priority = priority;
-            thread_to_operate = t;
-        }
-    }
-    ASSERT(thread_to_operate != NULL);
-    list_remove(&thread_to_operate->elem);
+  if (!heap_empty (&sema->waiters)){
+    thread_to_operate = heap_entry (heap_pop (&sema->waiters),
+                                    struct thread, wait_elem);
+    thread_to_operate->wait_sema = NULL;
     thread_unblock(thread_to_operate);
   }
 
   sema->value++;
 
   /* Preemption */
-  if(thread_to_operate && thread_to_operate->priority > thread_current()->priority){
+  if(thread_to_operate && thread_get_priority_any (thread_to_operate)
+                          > thread_get_priority ()){
     if(intr_context()){
       intr_yield_on_return();
     }else{
@@ -145,6 +142,18 @@ sema_up (struct semaphore *sema)
   intr_set_level (old_level);
 }
 
+/* Orders the waiters of a semaphore by effective priority,
+   highest first. */
+static bool
+sema_waiter_less (const struct heap_elem *a_, const struct heap_elem *b_,
+                  void *aux UNUSED)
+{
+  struct thread *a = heap_entry (a_, struct thread, wait_elem);
+  struct thread *b = heap_entry (b_, struct thread, wait_elem);
+
+  return thread_get_priority_any (a) > thread_get_priority_any (b);
+}
+
 static void sema_test_helper (void *sema_);
 
 /* Self-test for semaphores that makes control "ping-pong"
@@ -213,54 +222,55 @@ lock_init (struct lock *lock)
    This function may sleep, so it must not be called within an
    interrupt handler.  This function may be called with
    interrupts disabled, but interrupts will be turned back on if
-   we need to sleep. */
+   we need to sleep.
+
+   While a thread waits for LOCK, the lock's waiters donate the
+   highest of their priorities to its holder, and on up the chain
+   if the holder is itself waiting for a lock.
 
-/* Should not call malloc here*/
+   Should not call malloc here. */
 void
 lock_acquire (struct lock *lock)
 {
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
   ASSERT (lock != NULL);
   ASSERT (!intr_context ());
   ASSERT (!lock_held_by_current_thread (lock));
 
-  if(!thread_mlfqs){
-    /*donation*/
-    enum intr_level old_level;
-    old_level = intr_disable ();
-
-    if(lock->holder){
-      thread_current()->wait_on_lock = lock;
-      thread_current()->wait_on_thread = lock->holder;
-      thread_accept_donation(lock->holder, thread_current(), lock);
-    }
-
-    
-    sema_down (&lock->semaphore);
-    if(thread_current()->wait_on_thread){
-      if(thread_is_alive(thread_current()->wait_on_thread)){
-        thread_retrieve_donation(thread_current()->wait_on_thread, lock);
-      }
-      thread_current()->wait_on_lock = NULL;
-      thread_current()->wait_on_thread = NULL;
+  /* This is sema_down(), except that joining the waiters may
+     raise what the lock donates to its holder. */
+  old_level = intr_disable ();
+  while (lock->semaphore.value == 0)
+    {
+      cur->wait_on_lock = lock;
+      cur->wait_sema = &lock->semaphore;
+      heap_push (&lock->semaphore.waiters, &cur->wait_elem);
+      if (lock->holder != NULL)
+        {
+          heap_update (&lock->holder->held_locks, &lock->held_elem);
+          thread_update_priority (lock->holder);
+        }
+      thread_block ();
     }
+  lock->semaphore.value--;
+  cur->wait_on_lock = NULL;
+  take_lock (lock);
+  intr_set_level (old_level);
+}
 
-    lock->holder = thread_current ();
-
-    // Transfer donation, those waiter should start to wait on current thread instead
-    struct list* waiters = &(lock->semaphore.waiters);
-    for(struct list_elem *e = list_begin(waiters); e != list_end(waiters); e = list_next(e)){
-      struct thread* waiting_thread = list_entry(e, struct thread, elem);
-      if(waiting_thread == thread_current()) continue;
-      waiting_thread->wait_on_lock = lock;
-      waiting_thread->wait_on_thread = thread_current();
-      thread_accept_donation(thread_current(), waiting_thread, lock);
-    }
+/* Makes the running thread the holder of LOCK, which it has just
+   downed, so that the threads still waiting for LOCK donate to
+   it.  Must be called with interrupts off. */
+static void
+take_lock (struct lock *lock)
+{
+  struct thread *cur = thread_current ();
 
-    intr_set_level (old_level);
-  }else{
-    sema_down (&lock->semaphore);
-    lock->holder = thread_current ();
-  }
+  lock->holder = cur;
+  heap_push (&cur->held_locks, &lock->held_elem);
+  thread_update_priority (cur);
 }
 
 /* Tries to acquires LOCK and returns true if successful or false
@@ -272,14 +282,17 @@ lock_acquire (struct lock *lock)
 bool
 lock_try_acquire (struct lock *lock)
 {
+  enum intr_level old_level;
   bool success;
 
   ASSERT (lock != NULL);
   ASSERT (!lock_held_by_current_thread (lock));
 
+  old_level = intr_disable ();
   success = sema_try_down (&lock->semaphore);
   if (success)
-    lock->holder = thread_current ();
+    take_lock (lock);
+  intr_set_level (old_level);
   return success;
 }
 
@@ -291,11 +304,17 @@ lock_try_acquire (struct lock *lock)
 void
 lock_release (struct lock *lock) 
 {
+  enum intr_level old_level;
+
   ASSERT (lock != NULL);
   ASSERT (lock_held_by_current_thread (lock));
 
+  old_level = intr_disable ();
+  heap_remove (&thread_current ()->held_locks, &lock->held_elem);
   lock->holder = NULL;
+  thread_update_priority (thread_current ());
   sema_up (&lock->semaphore);
+  intr_set_level (old_level);
 }
 
 /* Returns true if the current thread holds LOCK, false
@@ -309,12 +328,12 @@ lock_held_by_current_thread (const struct lock *lock)
   return lock->holder == thread_current ();
 }
 
-/* One semaphore in a list. */
+/* One semaphore in a condition's waiters. */
 struct semaphore_elem 
   {
-    struct list_elem elem;              /* List element. */
+    struct heap_elem elem;              /* Heap element. */
     struct semaphore semaphore;         /* This semaphore. */
-    int priority;
+    struct thread *thread;              /* Thread waiting on it. */
   };
 
 /* Initializes condition variable COND.  A condition variable
@@ -325,7 +344,7 @@ cond_init (struct condition *cond)
 {
   ASSERT (cond != NULL);
 
-  list_init (&cond->waiters);
+  heap_init (&cond->waiters, cond_waiter_less, NULL);
 }
 
 /* Atomically releases LOCK and waits for COND to be signaled by
@@ -352,6 +371,8 @@ void
 cond_wait (struct condition *cond, struct lock *lock) 
 {
   struct semaphore_elem waiter; //temporary semaphore
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
 
   ASSERT (cond != NULL);
   ASSERT (lock != NULL);
@@ -359,8 +380,16 @@ cond_wait (struct condition *cond, struct lock *lock)
   ASSERT (lock_held_by_current_thread (lock));
   
   sema_init (&waiter.semaphore, 0);
-  waiter.priority = thread_current()->priority;
-  list_push_back (&cond->waiters, &waiter.elem);
+  waiter.thread = cur;
+
+  // Donations may re-key the heap from any thread, or from the
+  // timer interrupt under mlfqs, so touch it with interrupts off.
+  old_level = intr_disable ();
+  cur->wait_cond = cond;
+  cur->cond_elem = &waiter.elem;
+  heap_push (&cond->waiters, &waiter.elem);
+  intr_set_level (old_level);
+
   lock_release (lock);
   sema_down (&waiter.semaphore);
   lock_acquire (lock);
@@ -381,21 +410,15 @@ cond_signal (struct condition *cond, struct lock *lock UNUSED)
   ASSERT (!intr_context ());
   ASSERT (lock_held_by_current_thread (lock));
 
-  struct semaphore_elem* semaphore_to_operate = NULL;
-  if (!list_empty (&cond->waiters)){
-    int min_priority = PRI_MIN - 1; 
-    for (struct list_elem* e = list_begin (&cond->waiters); e != list_end (&cond->waiters); e = list_next (e)){
-        struct semaphore_elem *t = list_entry (e, struct semaphore_elem, elem);
-        if( t->priority > min_priority){
-            min_priority = t->priority;
-            semaphore_to_operate = t;
-        }
-    }
-    list_remove(&semaphore_to_operate->elem);
+  enum intr_level old_level = intr_disable ();
+  if (!heap_empty (&cond->waiters)){
+    struct semaphore_elem* semaphore_to_operate =
+      heap_entry (heap_pop (&cond->waiters), struct semaphore_elem, elem);
+    semaphore_to_operate->thread->wait_cond = NULL;
+    semaphore_to_operate->thread->cond_elem = NULL;
     sema_up(&semaphore_to_operate->semaphore);
   }
-  // sema_up (&list_entry (list_pop_front (&cond->waiters),
-                          // struct semaphore_elem, elem)->semaphore);
+  intr_set_level (old_level);
 }
 
 /* Wakes up all threads, if any, waiting on COND (protected by
@@ -410,6 +433,132 @@ cond_broadcast (struct condition *cond, struct lock *lock)
   ASSERT (cond != NULL);
   ASSERT (lock != NULL);
 
-  while (!list_empty (&cond->waiters))
+  while (!heap_empty (&cond->waiters))
     cond_signal (cond, lock);
 }
+
+/* Orders the waiters of a condition variable by the effective
+   priority of their threads at the time of comparison, highest
+   first. */
+static bool
+cond_waiter_less (const struct heap_elem *a_, const struct heap_elem *b_,
+                  void *aux UNUSED)
+{
+  struct semaphore_elem *a = heap_entry (a_, struct semaphore_elem, elem);
+  struct semaphore_elem *b = heap_entry (b_, struct semaphore_elem, elem);
+
+  return (thread_get_priority_any (a->thread)
+          > thread_get_priority_any (b->thread));
+}
+
+/* Restores T's place in the semaphore or condition variable it is
+   waiting on, if any, after T's effective priority has changed.
+   Must be called with interrupts off. */
+void
+synch_requeue (struct thread *t)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (t->wait_sema != NULL)
+    heap_update (&t->wait_sema->waiters, &t->wait_elem);
+  if (t->wait_cond != NULL)
+    heap_update (&t->wait_cond->waiters, t->cond_elem);
+}
+
+/* Initializes RWLOCK.  Any number of threads may hold a
+   readers-writer lock for reading at once, or a single thread
+   may hold it for writing.
+
+   Waiting writers are preferred: once a writer is waiting, new
+   readers wait until it has been through, so that a steady
+   stream of readers cannot starve writers.  A consequence is
+   that a thread must not acquire the same RWLOCK for reading
+   twice, since a writer arriving in between would deadlock with
+   it.  A readers-writer lock is not recursive in either mode. */
+void
+rwlock_init (struct rwlock *rwlock)
+{
+  ASSERT (rwlock != NULL);
+
+  lock_init (&rwlock->lock);
+  cond_init (&rwlock->can_read);
+  cond_init (&rwlock->can_write);
+  rwlock->reader_cnt = 0;
+  rwlock->waiting_writer_cnt = 0;
+  rwlock->writer = NULL;
+}
+
+/* Acquires RWLOCK for reading, sleeping until no thread is
+   writing or waiting to write. */
+void
+rwlock_acquire_read (struct rwlock *rwlock)
+{
+  ASSERT (rwlock != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (rwlock->writer != thread_current ());
+
+  lock_acquire (&rwlock->lock);
+  while (rwlock->writer != NULL || rwlock->waiting_writer_cnt > 0)
+    cond_wait (&rwlock->can_read, &rwlock->lock);
+  rwlock->reader_cnt++;
+  lock_release (&rwlock->lock);
+}
+
+/* Releases RWLOCK, which the current thread holds for reading. */
+void
+rwlock_release_read (struct rwlock *rwlock)
+{
+  ASSERT (rwlock != NULL);
+
+  lock_acquire (&rwlock->lock);
+  ASSERT (rwlock->reader_cnt > 0);
+  if (--rwlock->reader_cnt == 0)
+    cond_signal (&rwlock->can_write, &rwlock->lock);
+  lock_release (&rwlock->lock);
+}
+
+/* Acquires RWLOCK for writing, sleeping until no other thread
+   holds it. */
+void
+rwlock_acquire_write (struct rwlock *rwlock)
+{
+  ASSERT (rwlock != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (rwlock->writer != thread_current ());
+
+  lock_acquire (&rwlock->lock);
+  rwlock->waiting_writer_cnt++;
+  while (rwlock->writer != NULL || rwlock->reader_cnt > 0)
+    cond_wait (&rwlock->can_write, &rwlock->lock);
+  rwlock->waiting_writer_cnt--;
+  rwlock->writer = thread_current ();
+  lock_release (&rwlock->lock);
+}
+
+/* Releases RWLOCK, which the current thread holds for writing.
+   Hands it to the next waiting writer if there is one, otherwise
+   to all waiting readers. */
+void
+rwlock_release_write (struct rwlock *rwlock)
+{
+  ASSERT (rwlock != NULL);
+  ASSERT (rwlock_held_for_write (rwlock));
+
+  lock_acquire (&rwlock->lock);
+  rwlock->writer = NULL;
+  if (rwlock->waiting_writer_cnt > 0)
+    cond_signal (&rwlock->can_write, &rwlock->lock);
+  else
+    cond_broadcast (&rwlock->can_read, &rwlock->lock);
+  lock_release (&rwlock->lock);
+}
+
+/* Returns true if the current thread holds RWLOCK for writing,
+   false otherwise. */
+bool
+rwlock_held_for_write (const struct rwlock *rwlock)
+{
+  ASSERT (rwlock != NULL);
+
+  return rwlock->writer == thread_current ();
+}
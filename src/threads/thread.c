@@ -3,6 +3,7 @@
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
+#include "filesys/path.h"
 #include "threads/flags.h"
 #include "threads/fpoint.h"
 #include "threads/interrupt.h"
@@ -27,9 +28,9 @@
    of thread.h for details. */
 #define THREAD_MAGIC 0xcd6abf4b
 
-/* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list;
+/* Processes in THREAD_READY state, that is, processes that are
+   ready to run but not actually running, bucketed by priority. */
+static struct ready_queue ready_queue;
 
 /* List of all processes.  Processes are added to this list
    when they are first scheduled and removed when they exit. */
@@ -64,6 +65,15 @@ static long long user_ticks;   /* # of timer ticks in user programs. */
 static unsigned thread_ticks; /* # of timer ticks since last yield. */
 static fixed_point load_avg;
 
+/* Once a second, mlfqs decays recent_cpu by a coefficient that
+   depends on load_avg.  Only running and ready threads are
+   decayed at once; a blocked thread catches up on the decays it
+   missed when it is unblocked, using the coefficients remembered
+   here.  Coefficient I is in decay_coefs[I % DECAY_HISTORY]. */
+#define DECAY_HISTORY 64
+static fixed_point decay_coefs[DECAY_HISTORY];
+static unsigned decay_cnt;	/* # of per-second decays so far. */
+
 /* If false (default), use round-robin scheduler.
    If true, use multi-level feedback queue scheduler.
    Controlled by kernel command-line option "-o mlfqs". */
@@ -80,9 +90,11 @@ static void *alloc_frame(struct thread *, size_t size);
 static void schedule(void);
 void thread_schedule_tail(struct thread *prev);
 static tid_t allocate_tid(void);
-static void try_awake(struct thread *t, void *current_time);
 static void recalculate_priority(struct thread *t, void *_);
-static void recalculate_recent_cpu(struct thread *t, void *_);
+static void recalculate_second(struct thread *t, void *_);
+static void catch_up_decay(struct thread *t);
+static int mlfqs_priority(struct thread *t);
+static void thread_requeue(struct thread *t);
 /* Initializes the threading system by transforming the code
    that's currently running into a thread.  This can't work in
    general and it is possible in this case only because loader.S
@@ -101,7 +113,7 @@ void thread_init(void) {
 
 	lock_init(&tid_lock);
 	lock_init(&exec_list_lock);
-	list_init(&ready_list);
+	ready_queue_init(&ready_queue);
 	list_init(&all_list);
 	list_init(&exec_list);
 
@@ -150,14 +162,13 @@ void thread_tick(void) {
 		kernel_ticks++;
 
 	if (thread_mlfqs) {
-		int is_not_idle =
-			memcmp(thread_current()->name, "idle", 4) == 0 ? 0 : 1;
+		bool is_not_idle = t != idle_thread;
 		if (is_not_idle) {
 			t->recent_cpu = add_constant(t->recent_cpu, 1);
 		}
 		/* Calculate recent_cpu and load_average*/
 		if (timer_ticks() % TIMER_FREQ == 0) {
-			int ready_thread_counts = list_size(&ready_list) + is_not_idle;
+			int ready_thread_counts = ready_queue_size(&ready_queue) + is_not_idle;
 			fixed_point load_avg_1 =
 				times(div(to_fixed_point(59), to_fixed_point(60)), load_avg);
 			fixed_point load_avg_2 =
@@ -165,13 +176,16 @@ void thread_tick(void) {
 							   ready_thread_counts);
 			load_avg = add(load_avg_1, load_avg_2);
 
-			enum intr_level old_level;
-			old_level = intr_disable();
-
-			thread_foreach(recalculate_recent_cpu, NULL);
-			thread_foreach(recalculate_priority, NULL);
-			intr_set_level(old_level);
+			/* The decay coefficient is the same for every thread. */
+			decay_coefs[decay_cnt % DECAY_HISTORY] =
+				div(times_constant(load_avg, 2),
+					add_constant(times_constant(load_avg, 2), 1));
+			decay_cnt++;
 
+			/* Interrupts are already off in the timer interrupt. */
+			ready_queue_recompute(&ready_queue, recalculate_second, NULL);
+			if (is_not_idle)
+				recalculate_second(t, NULL);
 		} else if (timer_ticks() % 4 == 0) {
 			// Only recalculate current thread's priority
 
@@ -179,10 +193,6 @@ void thread_tick(void) {
 		}
 	}
 
-	/* Awake other threads */
-	int64_t current_time = timer_ticks();
-	thread_foreach(try_awake, (void *)&current_time);
-
 	/* Enforce preemption. */
 	if (++thread_ticks >= TIME_SLICE)
 		intr_yield_on_return();
@@ -227,6 +237,12 @@ tid_t thread_create(const char *name, int priority, thread_func *function,
 	init_thread(t, name, priority);
 	tid = t->tid = allocate_tid();
 
+#ifdef FILESYS
+	/* Start out in the creator's working directory. */
+	if (thread_current()->cwd != NULL)
+		t->cwd = dir_reopen(thread_current()->cwd);
+#endif
+
 	/* Stack frame for kernel_thread(). */
 	kf = alloc_frame(t, sizeof *kf);
 	kf->eip = NULL;
@@ -249,7 +265,7 @@ tid_t thread_create(const char *name, int priority, thread_func *function,
 	thread_unblock(t);
 
 	/* Preemption */
-	if (t->priority > thread_current()->priority) {
+	if (t->effective_priority > thread_current()->effective_priority) {
 		thread_yield();
 	}
 
@@ -285,7 +301,11 @@ void thread_unblock(struct thread *t) {
 
 	old_level = intr_disable();
 	ASSERT(t->status == THREAD_BLOCKED);
-	list_push_back(&ready_list, &t->elem);
+	if (thread_mlfqs) {
+		catch_up_decay(t);
+		t->priority = t->effective_priority = mlfqs_priority(t);
+	}
+	ready_queue_push(&ready_queue, t);
 	t->status = THREAD_READY;
 
 	intr_set_level(old_level);
@@ -325,22 +345,29 @@ void thread_exit(void) {
 #ifdef USERPROG
 	close_all_file(&thread_current()->fd_table);
 #endif
+#ifdef FILESYS
+	dir_close(thread_current()->cwd);
+	path_cache_destroy(thread_current()->path_cache);
+	thread_current()->cwd = NULL;
+	thread_current()->path_cache = NULL;
+#endif
 
 	if (block) {
-		ASSERT(block->command);
-
 		if (block->status != THREAD_EXIT) {
 			block->status = THREAD_KILLED;
 			thread_current()->exit_status = -1;
 		}
 
 		block->exit_status = thread_current()->exit_status;
-		printf("%s: exit(%d)\n", block->command, block->exit_status);
+		/* A forked child may fail before it has a command. */
+		printf("%s: exit(%d)\n",
+			   block->command != NULL ? block->command : thread_name(),
+			   block->exit_status);
 
+#ifdef USERPROG
 		/* Deny Write to Executable*/
-		lock_acquire(&filesys_lock);
 		file_close(block->executable);
-		lock_release(&filesys_lock);
+#endif
 
 		// Status can be PARENT_DIED / THREAD_EXIT / OTHERS
 		if (block->status == PARENT_DIED) {
@@ -383,7 +410,7 @@ void thread_yield(void) {
 
 	old_level = intr_disable();
 	if (cur != idle_thread)
-		list_push_back(&ready_list, &cur->elem);
+		ready_queue_push(&ready_queue, cur);
 	cur->status = THREAD_READY;
 	schedule();
 	intr_set_level(old_level);
@@ -404,8 +431,8 @@ void thread_foreach(thread_action_func *func, void *aux) {
 }
 
 void print_thread_internal(struct thread *t) {
-	debug_printf("Thread %s, sleep_time %lld\n, priority %d", t->name,
-				 t->sleep_time, t->priority);
+	debug_printf("Thread %s, wakeup_tick %lld\n, priority %d", t->name,
+				 t->wakeup_tick, t->priority);
 }
 
 void print_thread(char *name) {
@@ -424,132 +451,75 @@ void print_thread(char *name) {
 	intr_set_level(old_level);
 }
 
-void thread_accept_donation(struct thread *receiver, struct thread *donator,
-							struct lock *l) {
-	ASSERT(receiver != NULL);
-	ASSERT(donator != NULL);
-	ASSERT(l != NULL);
-
-	bool found = false;
-	struct donation_block *d;
-	for (int i = 0; i < MAX_NESTED_LEVEL; ++i) {
-		if (donator->donation_blocks[i].donator_wait_on_lock == NULL) {
-			found = true;
-			d = &(donator->donation_blocks[i]);
-			break;
-		}
-	}
-	ASSERT(found);
-
-	// Record thread to wait on
-	struct donation_block *block =
-		list_entry(&d->donation_elem, struct donation_block, donation_elem);
-	block->donator_wait_on_lock = l;
-	block->donator_thread = donator;
-
-	// O(n) insert donator's priority into list
-	int new_donator_priority = thread_get_priority_any(block->donator_thread);
-
-	struct list_elem *e;
-	bool insert = false;
-	for (e = list_begin(&receiver->priority_list);
-		 e != list_end(&receiver->priority_list); e = list_next(e)) {
-		struct donation_block *current_block =
-			list_entry(e, struct donation_block, donation_elem);
-		int current_donator_priority =
-			thread_get_priority_any(current_block->donator_thread);
-		if (new_donator_priority >= current_donator_priority) {
-			list_insert(e, &d->donation_elem);
-			insert = true;
-			break;
-		}
-	}
-	if (!insert) {
-		list_push_back(&receiver->priority_list, &d->donation_elem);
-	}
-
-	// Nested
-	if (receiver->wait_on_thread) {
-		thread_accept_donation(receiver->wait_on_thread, donator,
-							   receiver->wait_on_lock);
-	}
-}
-
-bool thread_is_alive(struct thread *target) {
-	ASSERT(target);
-	struct list_elem *e;
-
-	bool found = false;
-	for (e = list_begin(&all_list); e != list_end(&all_list);
-		 e = list_next(e)) {
-		struct thread *t = list_entry(e, struct thread, allelem);
-		if (t == target)
-			found = true;
-	}
-	return found;
-}
-
-void thread_retrieve_donation(struct thread *t, struct lock *l) {
-	ASSERT(t != NULL);
-	ASSERT(l != NULL);
-
-	struct list_elem *e = list_begin(&t->priority_list);
-
-	bool found = false;
-
-	while (e != list_end(&t->priority_list)) {
-		struct donation_block *current_block =
-			list_entry(e, struct donation_block, donation_elem);
-		struct list_elem *next_e = list_next(e);
+/* Returns the highest effective priority among the threads
+   waiting for L, or PRI_MIN - 1 if there are none.  That is the
+   priority L donates to its holder. */
+static int lock_priority(const struct lock *l) {
+	struct heap_elem *front = heap_front(&l->semaphore.waiters);
+	if (front == NULL)
+		return PRI_MIN - 1;
+	return heap_entry(front, struct thread, wait_elem)->effective_priority;
+}
+
+/* Orders a thread's held locks by the priority they donate,
+   highest first. */
+static bool held_lock_less(const struct heap_elem *a,
+						   const struct heap_elem *b, void *aux UNUSED) {
+	return lock_priority(heap_entry(a, struct lock, held_elem)) >
+		   lock_priority(heap_entry(b, struct lock, held_elem));
+}
+
+/* Recomputes T's effective priority from its base priority and
+   the locks it holds, after either may have changed.  If it
+   changed, moves T within the run queue or the waiters it is in
+   and passes the change on to the holder of the lock T is
+   waiting for, and so on up the chain of waiting threads until
+   a priority stays the same.  Each step costs O(log n).  Must be
+   called with interrupts off. */
+void thread_update_priority(struct thread *t) {
+	ASSERT(intr_get_level() == INTR_OFF);
 
-		// 10 taker
-		// 10 l1, 11 l1, 12 l1, // chain
-		// 7 l1 // single
+	while (t != NULL) {
+		int priority = t->priority;
+		struct lock *l;
 
-		if (current_block->donator_wait_on_lock == l) {
-			current_block->donator_wait_on_lock = NULL;
-			current_block->donator_thread = NULL;
-			list_remove(e);
-			found = true;
+		if (!thread_mlfqs && !heap_empty(&t->held_locks)) {
+			int donated = lock_priority(heap_entry(
+				heap_front(&t->held_locks), struct lock, held_elem));
+			if (donated > priority)
+				priority = donated;
 		}
-		e = next_e;
-	}
+		if (priority == t->effective_priority)
+			break;
+		t->effective_priority = priority;
+		thread_requeue(t);
 
-	ASSERT(found);
-	e = list_begin(&t->priority_list);
-	for (; e != list_end(&t->priority_list); e = list_next(e)) {
-		struct donation_block *current_block =
-			list_entry(e, struct donation_block, donation_elem);
-		ASSERT(current_block->donator_thread);
+		/* T's new place among the waiters for L may change what L
+		   donates to its holder. */
+		l = t->wait_on_lock;
+		if (l == NULL || l->holder == NULL)
+			break;
+		heap_update(&l->holder->held_locks, &l->held_elem);
+		t = l->holder;
 	}
-	// struct thread *new_donator = list_entry (donator_elem, struct thread,
-	// donation_elem); ASSERT(new_donator->wait_on_lock == t);
-	// new_donator->wait_on_lock = NULL;
 }
 
 /* Sets the current thread's priority to NEW_PRIORITY. */
 void thread_set_priority(int new_priority) {
-	int old_priority = thread_current()->priority;
-	thread_current()->priority = new_priority;
-	if (new_priority < old_priority)
+	struct thread *cur = thread_current();
+	int old_priority = cur->effective_priority;
+	enum intr_level old_level = intr_disable();
+
+	cur->priority = new_priority;
+	thread_update_priority(cur);
+	intr_set_level(old_level);
+	if (cur->effective_priority < old_priority)
 		thread_yield();
 }
 
-scheduler_type thread_get_priority_any(struct thread *t) {
-	// mlfqs
-	if (thread_mlfqs) {
-		return t->priority;
-	} else {
-		// priority donation
-		if (list_empty(&t->priority_list)) {
-			return t->priority;
-		} else {
-			struct donation_block *highest_donator_block =
-				list_entry(list_front(&t->priority_list), struct donation_block,
-						   donation_elem);
-			return highest_donator_block->donator_thread->priority;
-		}
-	}
+/* Returns T's effective priority, which includes donations. */
+int thread_get_priority_any(struct thread *t) {
+	return t->effective_priority;
 }
 
 /* Returns the current thread's priority. */
@@ -577,33 +547,71 @@ int thread_get_recent_cpu() {
 	return 100 * thread_get_recent_cpu_any(thread_current());
 }
 
-/* Run in external interrupt context */
-static void try_awake(struct thread *t, void *current_time) {
-	if (t->sleep_time != THREAD_NOT_SLEEP &&
-		t->sleep_time <= *(int64_t *)current_time) {
-		ASSERT(t->sleep_time == *(int64_t *)current_time);
-		sema_up(&t->sleep_semaphore);
-		t->sleep_time = THREAD_NOT_SLEEP;
+/* Applies to T's recent_cpu the per-second decays it has not
+   had yet, which are those it missed while blocked plus, for a
+   running or ready thread, the one just computed.  Run with
+   interrupts off. */
+static void catch_up_decay(struct thread *t) {
+	unsigned missed = decay_cnt - t->decay_cnt;
+
+	/* Decays too old to be remembered use the oldest coefficient
+	   that is.  Repeating one decay soon stops changing
+	   recent_cpu, so stop there. */
+	if (missed > DECAY_HISTORY) {
+		fixed_point coef = decay_coefs[decay_cnt % DECAY_HISTORY];
+		unsigned excess;
+
+		for (excess = missed - DECAY_HISTORY; excess > 0; excess--) {
+			fixed_point next =
+				add_constant(times(t->recent_cpu, coef), t->nice);
+			if (next == t->recent_cpu)
+				break;
+			t->recent_cpu = next;
+		}
+		missed = DECAY_HISTORY;
 	}
+	for (; missed > 0; missed--)
+		t->recent_cpu = add_constant(
+			times(t->recent_cpu,
+				  decay_coefs[(decay_cnt - missed) % DECAY_HISTORY]),
+			t->nice);
+	t->decay_cnt = decay_cnt;
 }
 
-/* run with interrupt off */
-static void recalculate_recent_cpu(struct thread *t, void *_ UNUSED) {
-	fixed_point recent_cpu_coef =
-		div((times_constant(load_avg, 2)),
-			add_constant(times_constant(load_avg, 2), 1));
-	t->recent_cpu =
-		add_constant(times(t->recent_cpu, recent_cpu_coef), t->nice);
-}
-
-/* run with interrupt off */
-static void recalculate_priority(struct thread *t, void *_ UNUSED) {
+/* Returns the mlfqs priority T's recent_cpu and nice call for. */
+static int mlfqs_priority(struct thread *t) {
 	int priority = PRI_MAX - thread_get_recent_cpu_any(t) / 4 - 2 * t->nice;
 	if (priority > PRI_MAX)
 		priority = PRI_MAX;
 	if (priority < PRI_MIN)
 		priority = PRI_MIN;
-	t->priority = priority;
+	return priority;
+}
+
+/* Once-a-second update of running or ready thread T.  Sets T's
+   priority without moving it between run queues, which is up to
+   the caller.  Run with interrupts off. */
+static void recalculate_second(struct thread *t, void *_ UNUSED) {
+	catch_up_decay(t);
+	t->priority = t->effective_priority = mlfqs_priority(t);
+}
+
+/* run with interrupt off */
+static void recalculate_priority(struct thread *t, void *_ UNUSED) {
+	t->priority = mlfqs_priority(t);
+	thread_update_priority(t);
+}
+
+/* Moves T to the run queue matching its effective priority if
+   it is ready, and re-keys it in whatever it is waiting on.
+   Called whenever a donation or recalculation may have changed
+   the priority of a thread other than the running one.  Must be
+   called with interrupts off. */
+static void thread_requeue(struct thread *t) {
+	ASSERT(intr_get_level() == INTR_OFF);
+	if (t->status == THREAD_READY)
+		ready_queue_update(&ready_queue, t);
+	synch_requeue(t);
 }
 
 /* Idle thread.  Executes when no other thread is ready to run.
@@ -682,21 +690,20 @@ static void init_thread(struct thread *t, const char *name, int priority) {
 	strlcpy(t->name, name, sizeof t->name);
 	t->stack = (uint8_t *)t + PGSIZE;
 	t->priority = priority;
+	t->effective_priority = priority;
 	t->magic = THREAD_MAGIC;
-	t->sleep_time = THREAD_NOT_SLEEP;
-	sema_init(&t->sleep_semaphore, 0);
-	list_init(&t->priority_list);
+	heap_init(&t->held_locks, held_lock_less, NULL);
 #ifdef USERPROG
 	fd_init(&t->fd_table);
 #endif
-
-	memset(&t->donation_blocks, 0,
-		   MAX_NESTED_LEVEL * sizeof(struct donation_block));
+#ifdef VM
+	list_init(&t->mappings);
+#endif
 
 	t->wait_on_lock = NULL;
-	t->wait_on_thread = NULL;
 	t->nice = 0;
 	t->recent_cpu = 0;
+	t->decay_cnt = decay_cnt;
 	t->exit_status = 0;
 
 	old_level = intr_disable();
@@ -721,11 +728,10 @@ static void *alloc_frame(struct thread *t, size_t size) {
    will be in the run queue.)  If the run queue is empty, return
    idle_thread. */
 static struct thread *_next_thread_to_run(void) {
-	if (list_empty(&ready_list))
+	if (ready_queue_empty(&ready_queue))
 		return idle_thread;
 	else
-		return next_thread_to_run(&ready_list);
-	// return list_entry (list_pop_front (&ready_list), struct thread, elem);
+		return next_thread_to_run(&ready_queue);
 }
 
 /* Completes a thread switch by activating the new thread's page
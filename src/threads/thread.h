@@ -2,6 +2,7 @@
 #define THREADS_THREAD_H
 
 #include <debug.h>
+#include <heap.h>
 #include <list.h>
 #include <stdint.h>
 #include "threads/synch.h"
@@ -54,9 +55,6 @@ typedef int tid_t;
 #define PRI_DEFAULT 31                  /* Default priority. */
 #define PRI_MAX 63                      /* Highest priority. */
 
-#define THREAD_NOT_SLEEP -1             /* Thread Sleep State */
-
-#define MAX_NESTED_LEVEL 8
 /* A kernel thread or user process.
 
    Each thread structure is stored in its own 4 kB page.  The
@@ -113,12 +111,6 @@ typedef int tid_t;
    only because they are mutually exclusive: only a thread in the
    ready state is on the run queue, whereas only a thread in the
    blocked state is on a semaphore wait list. */
-struct donation_block{
-   struct thread* donator_thread;
-   struct lock* donator_wait_on_lock;
-   struct list_elem donation_elem;     /* List element for donation */
-};
-
 struct thread
   {
     /* Owned by thread.c. */
@@ -128,38 +120,65 @@ struct thread
     char name[16];                      /* Name (for debugging purposes). */
     uint8_t *stack;                     /* Saved stack pointer. */
     int priority;                       /* Priority. */
+    int effective_priority;             /* Priority with donations. */
+    int ready_priority;                 /* Run queue we sit in (scheduler.c). */
     struct list_elem allelem;           /* List element for all threads list. */
 
     /* Shared between thread.c and synch.c. */
     struct list_elem elem;              /* List element. */
 
-    /* Who is waiting on this who*/
-    struct list priority_list;
+    /* Owned by synch.c. */
+    struct heap_elem wait_elem;         /* Element in wait_sema's waiters. */
+    struct semaphore *wait_sema;        /* Semaphore waited on, or null. */
+    struct heap_elem *cond_elem;        /* Element in wait_cond's waiters. */
+    struct condition *wait_cond;        /* Condition waited on, or null. */
 
     #ifdef USERPROG
     /* File descriptor */
     struct fd_table_t fd_table;
     #endif
 
-    // Maximum 8 nested level
-    struct donation_block donation_blocks[MAX_NESTED_LEVEL];
+#ifdef FILESYS
+    /* Owned by filesys/filesys.c and filesys/path.c. */
+    struct dir *cwd;                    /* Working directory, or null
+                                           for the root. */
+    struct path_cache *path_cache;      /* Recently resolved paths. */
+#endif
 
-    struct lock* wait_on_lock;
-    struct thread* wait_on_thread; 
+    /* Priority donation. */
+    struct heap held_locks;             /* Locks held, highest donor
+                                           first. */
+    struct lock* wait_on_lock;          /* Lock waited for, or null. */
 
-    int64_t sleep_time;
-    struct semaphore sleep_semaphore;
+    /* Owned by devices/timer.c. */
+    int64_t wakeup_tick;                /* Tick to wake up at. */
+    struct heap_elem sleep_elem;        /* Element in sleep queue. */
 
     int exit_status;
 
-    int nice;
-    fixed_point recent_cpu;
+    /* Owned by thread.c, for the mlfqs scheduler. */
+    int nice;                           /* Niceness. */
+    fixed_point recent_cpu;             /* Recent CPU time. */
+    unsigned decay_cnt;                 /* Per-second decays of recent_cpu
+                                           applied so far. */
 
 #ifdef USERPROG
     /* Owned by userprog/process.c. */
     uint32_t *pagedir;                  /* Page directory. */
 #endif
 
+#ifdef VM
+    /* Owned by vm/page.c. */
+    struct hash *pages;                 /* Supplemental page table. */
+    struct file *exec_file;             /* Executable, paged in lazily. */
+    void *user_esp;                     /* User stack pointer on entry
+                                           to the current system call. */
+
+    /* Owned by vm/mmap.c. */
+    struct list mappings;               /* Memory-mapped files. */
+    int next_mapid;                     /* Identifier for next mapping. */
+#endif
+
     /* Owned by thread.c. */
     unsigned magic;                     /* Detects stack overflow. */
   };
@@ -193,9 +212,7 @@ void thread_yield (void);
 typedef void thread_action_func (struct thread *t, void *aux);
 void thread_foreach (thread_action_func *, void *);
 
-bool thread_is_alive(struct thread*);
-
-scheduler_type thread_get_priority_any (struct thread*);
+int thread_get_priority_any (struct thread*);
 int thread_get_priority (void);
 void thread_set_priority (int);
 
@@ -206,9 +223,7 @@ int thread_get_recent_cpu_any (struct thread*);
 int thread_get_load_avg (void);
 
 
-/* Accept priority donation from another thread represented by list_elem*/
-void thread_accept_donation(struct thread*, struct thread*, struct lock*);
-void thread_retrieve_donation(struct thread*, struct lock*);
+void thread_update_priority(struct thread *);
 
 /* Exec and wait */
 struct thread* get_thread_by_tid(tid_t tid);
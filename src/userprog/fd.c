@@ -1,87 +1,110 @@
 #include "userprog/fd.h"
 #include "filesys/filesys.h"
 #include "filesys/file.h"
+#include "filesys/directory.h"
+#include "filesys/inode.h"
 #include <debug.h>
 #include <stdio.h>
+#include <string.h>
 #include "threads/malloc.h"
 #include "threads/thread.h"
-static bool _next_free_fd(struct fd_table_t* fd_table, uint32_t* fd_out);
-// /* Returns a hash value for fd p. */
-// static uint32_t fd_hash (const struct hash_elem *p_, void *aux UNUSED)
-// {
-//   const struct fd_t *p = hash_entry (p_, struct fd_t, hash_elem);
-//   return hash_int (p->fd);
-// }
 
-// /* Returns true if fd a precedes fd b. */
-// static bool fd_less (const struct hash_elem *a_, const struct hash_elem *b_,
-//            void *aux UNUSED)
-// {
-//   const struct fd_t *a = hash_entry (a_, struct fd_t, hash_elem);
-//   const struct fd_t *b = hash_entry (b_, struct fd_t, hash_elem);
+// fds 0, 1 and 2 are the console and are never handed out
+#define FIRST_FD 3
+#define NO_FD -1
 
-//   return a->fd < b->fd;
-// }
+static bool _grow(struct fd_table_t* fd_table);
+static bool _next_free_fd(struct fd_table_t* fd_table, uint32_t* fd_out);
+static void _free_fd(struct fd_table_t* fd_table, uint32_t fd);
 
-// TODO: Sync
-static bool _next_free_fd(struct fd_table_t* fd_table, uint32_t* fd_out){
-    for(int i = 0; i < MAX_FD; ++i){
-        if(!fd_table->fd_used_list[i]){
-            *fd_out = i;
-            fd_table->fd_used_list[i] = true;
-            return true;
+// Double the table, putting the new slots on the free list lowest first
+static bool _grow(struct fd_table_t* fd_table){
+    uint32_t old_cnt = fd_table->fd_cnt;
+    uint32_t new_cnt = old_cnt ? old_cnt * 2 : FD_INIT_CNT;
+    struct fd_t* fds = realloc(fd_table->fds, new_cnt * sizeof(struct fd_t));
+    if(!fds){
+        return false;
+    }
+    for(uint32_t i = new_cnt; i-- > old_cnt; ){
+        fds[i].file = NULL;
+        fds[i].dir = NULL;
+        fds[i].next_free = NO_FD;
+        if(i >= FIRST_FD){
+            fds[i].next_free = fd_table->free_head;
+            fd_table->free_head = i;
         }
     }
-    return false;
+    fd_table->fds = fds;
+    fd_table->fd_cnt = new_cnt;
+    return true;
+}
+
+// Take a slot off the free list, growing the table if there is none
+static bool _next_free_fd(struct fd_table_t* fd_table, uint32_t* fd_out){
+    if(fd_table->free_head == NO_FD && !_grow(fd_table)){
+        return false;
+    }
+    *fd_out = fd_table->free_head;
+    fd_table->free_head = fd_table->fds[*fd_out].next_free;
+    return true;
 }
-// hash_init(&(fd_table->fd_table), fd_hash, fd_less, NULL);
 
+// Put a slot whose file has been closed back on the free list
+static void _free_fd(struct fd_table_t* fd_table, uint32_t fd){
+    struct fd_t* fd_entry = &fd_table->fds[fd];
+    fd_entry->file = NULL;
+    fd_entry->dir = NULL;
+    fd_entry->next_free = fd_table->free_head;
+    fd_table->free_head = fd;
+}
+
+// Runs before malloc() works for the initial thread, so the array is allocated by the first open
 void fd_init(struct fd_table_t* fd_table){
-    list_init(&(fd_table->fd_list));
-    fd_table->fd_used_list[0] = true;
-    fd_table->fd_used_list[1] = true;
-    fd_table->fd_used_list[2] = true;
+    fd_table->fds = NULL;
+    fd_table->fd_cnt = 0;
+    fd_table->free_head = NO_FD;
 }
 
 static struct fd_t* _get_fd_entry(struct fd_table_t* fd_table, uint32_t fd){
-    struct list_elem *e;
-    struct fd_t* fd_entry = NULL;
-    for (e = list_begin (&(fd_table->fd_list)); e != list_end (&(fd_table->fd_list));
-        e = list_next (e)){
-        struct fd_t *fd_t = list_entry (e, struct fd_t, list_elem);
-        if(fd_t->fd == fd){
-            fd_entry = fd_t; 
-        }
+    if(fd >= fd_table->fd_cnt || !fd_table->fds[fd].file){
+        return NULL;
     }
-    return fd_entry;
+    return &fd_table->fds[fd];
 }
 
 struct file* get_open_file(struct fd_table_t* fd_table, uint32_t fd){
-    struct list_elem *e;
-    struct file* file = NULL;
-    for (e = list_begin (&(fd_table->fd_list)); e != list_end (&(fd_table->fd_list));
-        e = list_next (e)){
-        struct fd_t *fd_t = list_entry (e, struct fd_t, list_elem);
-        if(fd_t->fd == fd){
-            file = fd_t->file;
-            break;
-        }
-    }
-    return file;
+    struct fd_t* fd_entry = _get_fd_entry(fd_table, fd);
+    return fd_entry ? fd_entry->file : NULL;
+}
+
+// Returns the directory open as fd, or NULL if fd is not an open directory
+struct dir* get_open_dir(struct fd_table_t* fd_table, uint32_t fd){
+    struct fd_t* fd_entry = _get_fd_entry(fd_table, fd);
+    return fd_entry ? fd_entry->dir : NULL;
 }
 
 bool open_file(struct fd_table_t* fd_table, char* filename, uint32_t* fd_out){
-    if(!(_next_free_fd(fd_table, fd_out))){
-        return false;
-    }
     struct file* file = filesys_open(filename);
     if(!file){
         return false;
     }
-    struct fd_t* fd_entry = (struct fd_t*)malloc(sizeof(struct fd_t));
-    fd_entry->fd = *fd_out;
-    fd_entry->file = file;
-    list_push_back(&(fd_table->fd_list), &fd_entry->list_elem);
+    // Directories also get a dir handle, which keeps the readdir position
+    struct dir* dir = NULL;
+    struct inode* inode = file_get_inode(file);
+    if(inode_is_dir(inode)){
+        dir = dir_open(inode_reopen(inode));
+        if(!dir){
+            file_close(file);
+            return false;
+        }
+    }
+    if(!(_next_free_fd(fd_table, fd_out))){
+        file_close(file);
+        dir_close(dir);
+        return false;
+    }
+    fd_table->fds[*fd_out].file = file;
+    fd_table->fds[*fd_out].dir = dir;
     return true;
 }
 
@@ -91,22 +114,55 @@ bool close_file(struct fd_table_t* fd_table,  uint32_t fd){
       // Failed to get open file
       return false;
     }
-    list_remove(&fd_entry->list_elem);
-    fd_table->fd_used_list[fd] = false;
     file_close(fd_entry->file);
-    free(fd_entry);
+    dir_close(fd_entry->dir);
+    _free_fd(fd_table, fd);
     return true;
 }
 
 void close_all_file(struct fd_table_t* fd_table){
-    struct list_elem *e = list_begin (&(fd_table->fd_list));
-    while(e != list_end (&(fd_table->fd_list))){
-        struct fd_t *fd_entry = list_entry (e, struct fd_t, list_elem);
-        struct list_elem *tmp = e;
-        e = list_next (e);
-        list_remove(tmp);
-        fd_table->fd_used_list[fd_entry->fd] = false;
+    for(uint32_t fd = 0; fd < fd_table->fd_cnt; ++fd){
+        struct fd_t* fd_entry = &fd_table->fds[fd];
         file_close(fd_entry->file);
-        free(fd_entry);
+        dir_close(fd_entry->dir);
+    }
+    free(fd_table->fds);
+    fd_init(fd_table);
+}
+
+// Give dst, the empty table of a forked child, its own handle to every file open in src
+// Each handle starts at the same position, but directories are read from the start again
+// The fds are the same as in src, so the free list is copied as is
+bool copy_all_file(struct fd_table_t* dst, struct fd_table_t* src){
+    ASSERT(dst->fds == NULL);
+    if(src->fd_cnt == 0){
+        return true;
+    }
+    dst->fds = malloc(src->fd_cnt * sizeof(struct fd_t));
+    if(!dst->fds){
+        return false;
+    }
+    memcpy(dst->fds, src->fds, src->fd_cnt * sizeof(struct fd_t));
+    dst->fd_cnt = src->fd_cnt;
+    dst->free_head = src->free_head;
+
+    bool success = true;
+    for(uint32_t fd = 0; fd < dst->fd_cnt; ++fd){
+        struct fd_t* fd_entry = &dst->fds[fd];
+        struct file* file = fd_entry->file;
+        struct dir* dir = fd_entry->dir;
+        if(!file){
+            continue;
+        }
+        // Slots not reached after a failure stay NULL for close_all_file()
+        fd_entry->file = success ? file_reopen(file) : NULL;
+        fd_entry->dir = success && dir ? dir_reopen(dir) : NULL;
+        if(success && (!fd_entry->file || (dir && !fd_entry->dir))){
+            success = false;
+        }
+        if(fd_entry->file){
+            file_seek(fd_entry->file, file_tell(file));
+        }
     }
+    return success;
 }
@@ -1,27 +1,34 @@
-
-#ifndef USERPROG_FD_H
-#define USERPROG_FD_H
-
-#include <hash.h>
-
-#define MAX_FD 128
-
-// fd table per process
-struct fd_table_t{
-    struct list fd_list; 
-    bool fd_used_list[MAX_FD];
-};
-
-struct fd_t{
-    struct list_elem list_elem;
-    uint32_t fd;
-    struct file* file;
-};
-
-
-void fd_init (struct fd_table_t* fd_table);
-struct file* get_open_file(struct fd_table_t* fd_table, uint32_t fd);
-bool open_file(struct fd_table_t* fd_table, char* filename, uint32_t* fd_out);
-bool close_file(struct fd_table_t* fd_table, uint32_t fd);
-void close_all_file(struct fd_table_t* fd_table);
-#endif /* userprog/fd.h */
+#ifndef USERPROG_FD_H
+#define USERPROG_FD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Number of slots a table starts with once something is opened, doubled whenever it fills up
+#define FD_INIT_CNT 16
+
+// One slot of an fd table
+// A slot is in use iff file is not NULL, free slots are chained through next_free
+struct fd_t{
+    struct file* file;
+    struct dir* dir;    // Same inode as file if it is a directory, else NULL
+    int next_free;      // Next free slot, or -1
+};
+
+// fd table per process, an array indexed by fd
+// Only the owning thread touches it, so lookups take no lock
+struct fd_table_t{
+    struct fd_t* fds;   // fd_cnt slots, NULL until the first open
+    uint32_t fd_cnt;
+    int free_head;      // Slot the next open gets, or -1
+};
+
+
+void fd_init (struct fd_table_t* fd_table);
+struct file* get_open_file(struct fd_table_t* fd_table, uint32_t fd);
+struct dir* get_open_dir(struct fd_table_t* fd_table, uint32_t fd);
+bool open_file(struct fd_table_t* fd_table, char* filename, uint32_t* fd_out);
+bool close_file(struct fd_table_t* fd_table, uint32_t fd);
+void close_all_file(struct fd_table_t* fd_table);
+bool copy_all_file(struct fd_table_t* dst, struct fd_table_t* src);
+#endif /* userprog/fd.h */
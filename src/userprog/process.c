@@ -18,10 +18,17 @@
 #include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
+#ifdef VM
+#include "vm/mmap.h"
+#include "vm/page.h"
+#endif
 
 #define MAX_PARAMS 32
 
 static thread_func start_process NO_RETURN;
+#ifdef VM
+static thread_func start_fork NO_RETURN;
+#endif
 static bool load (const char *cmdline, void (**eip) (void), void **esp);
 
 
@@ -49,6 +56,103 @@ process_execute (const char *file_name)
   return tid;
 }
 
+#ifdef VM
+/* What a forked child copies from its parent.  The parent waits
+   on its exec block until the child is done with it. */
+struct fork_args
+  {
+    struct thread *parent;              /* Process being forked. */
+    struct intr_frame *if_;             /* Its user context. */
+  };
+
+/* Starts a new thread running a copy of the running user
+   process, which resumes from the system call that IF_ was saved
+   on entry to, with 0 as the call's result.  The caller must wait
+   on the child's exec block before returning to user mode.
+   Returns the new process's thread id, or TID_ERROR if the thread
+   cannot be created. */
+tid_t
+process_fork (struct intr_frame *if_)
+{
+  struct fork_args *args;
+  tid_t tid;
+
+  args = malloc (sizeof *args);
+  if (args == NULL)
+    return TID_ERROR;
+  args->parent = thread_current ();
+  args->if_ = if_;
+
+  tid = thread_create (thread_name (), PRI_DEFAULT, start_fork, args);
+  if (tid == TID_ERROR)
+    free (args);
+  return tid;
+}
+
+/* A thread function that copies the address space and open files
+   of the process that forked it and starts it running.  Writable
+   pages are shared copy-on-write, so little is copied now. */
+static void
+start_fork (void *args_)
+{
+  struct fork_args *args = args_;
+  struct thread *cur = thread_current ();
+  struct thread *parent = args->parent;
+  struct exec_block_t *block = thread_get_exec_block_from_child (cur->tid);
+  struct exec_block_t *parent_block
+    = thread_get_exec_block_from_child (parent->tid);
+  const char *command = parent_block != NULL ? parent_block->command
+                                             : parent->name;
+  struct intr_frame if_ = *args->if_;
+  bool success;
+
+  ASSERT (block != NULL);
+  free (args);
+
+  block->command = malloc (strlen (command) + 1);
+  success = block->command != NULL;
+  if (success)
+    strlcpy (block->command, command, strlen (command) + 1);
+
+  /* Until the exec block is signaled, PARENT stays blocked in the
+     system call, so nothing it has can change under us. */
+  if (success)
+    {
+      cur->pagedir = pagedir_create ();
+      success = cur->pagedir != NULL;
+    }
+  if (success)
+    {
+      process_activate ();
+      cur->exec_file = file_reopen (parent->exec_file);
+      success = (cur->exec_file != NULL
+                 && page_table_create ()
+                 && page_table_copy (parent)
+                 && copy_all_file (&cur->fd_table, &parent->fd_table));
+    }
+
+  /* On failure thread_exit() marks the block killed and signals
+     it. */
+  if (!success)
+    {
+      cur->exit_status = -1;
+      thread_exit ();
+    }
+
+  /* Deny write to executable */
+  block->executable = file_reopen (cur->exec_file);
+  if (block->executable)
+    file_deny_write (block->executable);
+  block->status = LOAD_SUCCESS;
+  sema_up (&block->exec_sem);
+
+  /* The child sees 0 as fork()'s result. */
+  if_.eax = 0;
+  asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
+  NOT_REACHED ();
+}
+#endif
+
 /* A thread function that loads a user process and starts it
    running. */
 static void
@@ -84,12 +188,10 @@ start_process (void *file_name_)
   block->status = success ? LOAD_SUCCESS : block->status;
   
   /* Deny write to executable*/
-  lock_acquire(&filesys_lock);
   block->executable = filesys_open(block->command);
   if(block->executable){
     file_deny_write(block->executable);
   }
-  lock_release(&filesys_lock);
 
   if(!block->initial){
     sema_up(&block->exec_sem);
@@ -224,6 +326,15 @@ process_exit (void)
   struct thread *cur = thread_current ();
   uint32_t *pd;
 
+#ifdef VM
+  /* Write back mapped files, and give back the process's frames
+     and swap slots, while its page directory still exists. */
+  mmap_unmap_all ();
+  page_table_destroy ();
+  file_close (cur->exec_file);
+  cur->exec_file = NULL;
+#endif
+
   /* Destroy the current process's page directory and switch back
      to the kernel-only page directory. */
   pd = cur->pagedir;
@@ -346,6 +457,10 @@ load (const char *file_name, void (**eip) (void), void **esp)
   if (t->pagedir == NULL) 
     goto done;
   process_activate ();
+#ifdef VM
+  if (!page_table_create ())
+    goto done;
+#endif
 
   /* Open executable file. */
   file = filesys_open (file_name);
@@ -438,12 +553,20 @@ load (const char *file_name, void (**eip) (void), void **esp)
 
  done:
   /* We arrive here whether the load is successful or not. */
+#ifdef VM
+  /* Pages are read from the executable as they are touched, so
+     keep it open. */
+  t->exec_file = file;
+#else
   file_close (file);
+#endif
   return success;
 }
 /* load() helpers. */
 
+#ifndef VM
 static bool install_page (void *upage, void *kpage, bool writable);
+#endif
 
 /* Checks whether PHDR describes a valid, loadable segment in
    FILE and returns true if so, false otherwise. */
@@ -502,6 +625,10 @@ validate_segment (const struct Elf32_Phdr *phdr, struct file *file)
    The pages initialized by this function must be writable by the
    user process if WRITABLE is true, read-only otherwise.
 
+   With virtual memory, the pages are only recorded in the
+   supplemental page table here and are read in when the process
+   first touches them.
+
    Return true if successful, false if a memory allocation error
    or disk read error occurs. */
 static bool
@@ -521,6 +648,11 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
       size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
       size_t page_zero_bytes = PGSIZE - page_read_bytes;
 
+#ifdef VM
+      if (!page_add_file (upage, file, ofs, page_read_bytes, writable))
+        return false;
+      ofs += page_read_bytes;
+#else
       /* Get a page of memory. */
       uint8_t *kpage = palloc_get_page (PAL_USER);
       if (kpage == NULL)
@@ -540,6 +672,7 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
           palloc_free_page (kpage);
           return false; 
         }
+#endif
 
       /* Advance. */
       read_bytes -= page_read_bytes;
@@ -554,6 +687,14 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
 static bool
 setup_stack (void **esp) 
 {
+#ifdef VM
+  uint8_t *upage = ((uint8_t *) PHYS_BASE) - PGSIZE;
+
+  if (!page_add_file (upage, NULL, 0, 0, true) || !page_load (upage))
+    return false;
+  *esp = PHYS_BASE;
+  return true;
+#else
   uint8_t *kpage;
   bool success = false;
 
@@ -567,8 +708,10 @@ setup_stack (void **esp)
         palloc_free_page (kpage);
     }
   return success;
+#endif
 }
 
+#ifndef VM
 /* Adds a mapping from user virtual address UPAGE to kernel
    virtual address KPAGE to the page table.
    If WRITABLE is true, the user process may modify the page;
@@ -588,3 +731,4 @@ install_page (void *upage, void *kpage, bool writable)
   return (pagedir_get_page (t->pagedir, upage) == NULL
           && pagedir_set_page (t->pagedir, upage, kpage, writable));
 }
+#endif
@@ -1,9 +1,13 @@
 #include "userprog/syscall.h"
 #include "userprog/pagedir.h"
 #include <stdio.h>
+#include <string.h>
 #include <syscall-nr.h>
+#include <uio.h>
 #include <debug.h>
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
 
@@ -11,12 +15,18 @@
 #include "userprog/process.h"
 #include "filesys/filesys.h"
 #include "filesys/file.h"
+#include "filesys/directory.h"
+#include "filesys/inode.h"
 #include "devices/shutdown.h"
 #include "devices/input.h"
+#ifdef VM
+#include "vm/mmap.h"
+#include "vm/page.h"
+#endif
 
 
 
-#define GET_ARGUMENT(ptr, index, type) is_valid((void*)((uint32_t)(ptr) + 4 * index + 3))?*(type*)((uint32_t)(ptr) + 4 * index) : *(type*)thread_exit_with_status(-1)
+#define GET_ARGUMENT(ptr, index, type) ((type)get_argument(ptr, index))
 #define READ_ERROR -1
 #define READ_SUCCESS 0
 
@@ -24,7 +34,20 @@
 
 static void syscall_handler (struct intr_frame *);
 static bool is_valid(const void* vaddr);
+static bool is_valid_range(const void* buffer, unsigned size, bool write);
+#ifdef VM
+static bool load_user_page(const void* vaddr, bool pin, bool write);
+#endif
+static void unpin_range(const void* buffer, unsigned size);
 static void* thread_exit_with_status(int status);
+static uint32_t get_argument(const void* esp, int index);
+static bool check_user_page(const void* uaddr, bool write);
+static bool copy_from_user(void* dst, const void* usrc, size_t size);
+static bool copy_to_user(void* udst, const void* src, size_t size);
+static int strncpy_from_user(char* dst, const char* usrc, size_t size);
+static char* copy_in_string(const char* ustr);
+static int read_fd(struct fd_table_t* fd_table, uint32_t fd, char* buffer, unsigned size, off_t position);
+static int write_fd(struct fd_table_t* fd_table, uint32_t fd, const char* buffer, unsigned size, off_t position);
 
 
 void
@@ -39,7 +62,231 @@ bool is_valid(const void* vaddr){
   if(!is_user_vaddr(vaddr)){
     return false;
   }
+#ifdef VM
+  // Pages not touched yet are legal too, bring them in now
+  if(pagedir_get_page(active_pd(), vaddr) == NULL){
+    return load_user_page(vaddr, false, false);
+  }
+  return true;
+#else
   return pagedir_get_page(active_pd(), vaddr) != NULL;
+#endif
+}
+
+// Determine if every page of a user buffer is legal
+// Checked up front so that file system code never faults on the buffer
+// With VM the pages are also pinned in memory until unpin_range()
+// Set write if the kernel will write to the buffer
+static bool is_valid_range(const void* buffer, unsigned size, bool write UNUSED){
+  const uint8_t* start = buffer;
+  const uint8_t* addr = buffer;
+  do{
+#ifdef VM
+    // Pages pinned so far are freed when the process is killed
+    if(!is_user_vaddr(addr) || !load_user_page(addr, true, write)){
+      return false;
+    }
+#else
+    if(!is_valid(addr)){
+      return false;
+    }
+#endif
+    addr = (const uint8_t*)pg_round_down(addr) + PGSIZE;
+  }while((uint32_t)(addr - start) < size);
+  return true;
+}
+
+#ifdef VM
+// Bring in the page holding a user address, pinned if pin is set
+// The stack grows to reach it if the address is near the saved esp
+// A pinned page about to be written must be writable and private
+static bool load_user_page(const void* vaddr, bool pin, bool write){
+  if(page_lookup(vaddr) == NULL
+     && !page_extend_stack(vaddr, thread_current()->user_esp)){
+    return false;
+  }
+  return pin ? page_pin(vaddr, write) : page_load(vaddr);
+}
+#endif
+
+// Check that the page holding a user address can be read, or written if write is set
+// With VM the page is brought in, and if it is evicted again before the kernel
+// touches it, the kernel's access just faults it back in
+static bool check_user_page(const void* uaddr, bool write){
+  if(!is_user_vaddr(uaddr)){
+    return false;
+  }
+#ifdef VM
+  if(!load_user_page(uaddr, false, false)){
+    return false;
+  }
+  return !write || page_lookup(uaddr)->writable;
+#else
+  return pagedir_get_page(active_pd(), uaddr) != NULL
+         && (!write || pagedir_is_writable(active_pd(), uaddr));
+#endif
+}
+
+// Copy size bytes from user address usrc into the kernel
+// Each page is checked once and copied as a whole run
+// Returns false if some byte is not readable user memory
+static bool copy_from_user(void* dst, const void* usrc, size_t size){
+  uint8_t* d = dst;
+  const uint8_t* s = usrc;
+  while(size > 0){
+    size_t run = PGSIZE - pg_ofs(s);
+    if(run > size){
+      run = size;
+    }
+    if(!check_user_page(s, false)){
+      return false;
+    }
+    memcpy(d, s, run);
+    d += run;
+    s += run;
+    size -= run;
+  }
+  return true;
+}
+
+// Copy size bytes from the kernel to user address udst, a page at a time
+// Returns false if some byte is not writable user memory
+static bool copy_to_user(void* udst, const void* src, size_t size){
+  uint8_t* d = udst;
+  const uint8_t* s = src;
+  while(size > 0){
+    size_t run = PGSIZE - pg_ofs(d);
+    if(run > size){
+      run = size;
+    }
+    if(!check_user_page(d, true)){
+      return false;
+    }
+    memcpy(d, s, run);
+    d += run;
+    s += run;
+    size -= run;
+  }
+  return true;
+}
+
+// Copy the string at user address usrc, with its null, into dst of size bytes
+// Returns its length, size if it does not fit, or -1 if it runs into bad memory
+static int strncpy_from_user(char* dst, const char* usrc, size_t size){
+  size_t len = 0;
+  while(len < size){
+    const char* s = usrc + len;
+    size_t run = PGSIZE - pg_ofs(s);
+    if(run > size - len){
+      run = size - len;
+    }
+    if(!check_user_page(s, false)){
+      return -1;
+    }
+    const char* nul = memchr(s, '\0', run);
+    if(nul){
+      memcpy(dst + len, s, nul - s + 1);
+      return len + (nul - s);
+    }
+    memcpy(dst + len, s, run);
+    len += run;
+  }
+  return size;
+}
+
+// Copy a string argument into a new page, to be freed with palloc_free_page()
+// Kills the process if the string is not in user memory
+// Returns NULL if it does not fit in a page, which fails the call
+static char* copy_in_string(const char* ustr){
+  char* kstr = palloc_get_page(0);
+  if(!kstr){
+    return NULL;
+  }
+  int len = strncpy_from_user(kstr, ustr, PGSIZE);
+  if(len < 0){
+    debug_printf("ERROR: invalid user string %p\n", ustr);
+    palloc_free_page(kstr);
+    thread_exit_with_status(-1);
+  }
+  if(len == PGSIZE){
+    palloc_free_page(kstr);
+    return NULL;
+  }
+  return kstr;
+}
+
+// Fetch the index'th 32-bit word on the user stack, killing the process if it is not user memory
+static uint32_t get_argument(const void* esp, int index){
+  uint32_t arg;
+  if(!copy_from_user(&arg, (const uint32_t*)esp + index, sizeof arg)){
+    thread_exit_with_status(-1);
+  }
+  return arg;
+}
+
+// Let the pages of a buffer checked by is_valid_range() be evicted again
+static void unpin_range(const void* buffer UNUSED, unsigned size UNUSED){
+#ifdef VM
+  const uint8_t* start = buffer;
+  const uint8_t* page = pg_round_down(buffer);
+  do{
+    page_unpin(page);
+    page += PGSIZE;
+  }while((uint32_t)(page - start) < size);
+#endif
+}
+
+// Read into a user buffer checked by is_valid_range()
+// At position if it is not negative, else at the file position
+static int read_fd(struct fd_table_t* fd_table, uint32_t fd, char* buffer, unsigned size, off_t position){
+  if(fd == STDIN_FILENO){
+    if(position >= 0){
+      // The console has no positions
+      return READ_ERROR;
+    }
+    buffer[0] = input_getc();
+    return 1;
+  }
+  struct file* file = get_open_file(fd_table, fd);
+  if(!file){
+    // Failed to get open file
+    debug_printf("ERROR: failed to get open file for fd %d\n", fd);
+    return READ_ERROR;
+  }
+  if(get_open_dir(fd_table, fd)){
+    // Directories are read with readdir
+    return READ_ERROR;
+  }
+  return position >= 0 ? file_read_at(file, buffer, size, position)
+                       : file_read(file, buffer, size);
+}
+
+// Write from a user buffer checked by is_valid_range()
+// At position if it is not negative, else at the file position
+// Kills the process if fd is not open
+static int write_fd(struct fd_table_t* fd_table, uint32_t fd, const char* buffer, unsigned size, off_t position){
+  if(fd == STDOUT_FILENO){
+    if(position >= 0){
+      return -1;
+    }
+    // Large buffers go out in pieces so that other output is not held up
+    for(unsigned done = 0; done < size; done += CHUNK){
+      putbuf(buffer + done, size - done < CHUNK ? size - done : CHUNK);
+    }
+    return size;
+  }
+  struct file* file = get_open_file(fd_table, fd);
+  if(!file){
+    // Failed to get open file
+    debug_printf("ERROR: failed to get open file for fd %d\n", fd);
+    thread_exit_with_status(-1);
+  }
+  if(get_open_dir(fd_table, fd)){
+    debug_printf("ERROR: cannot write to directory fd %d\n", fd);
+    return -1;
+  }
+  return position >= 0 ? file_write_at(file, buffer, size, position)
+                       : file_write(file, buffer, size);
 }
 
 static void* thread_exit_with_status(int status){
@@ -60,6 +307,10 @@ static void
 syscall_handler (struct intr_frame *f UNUSED) 
 {
   // intr_dump_frame(f);
+#ifdef VM
+  // Faults on the user stack during the call are judged by this esp
+  thread_current()->user_esp = f->esp;
+#endif
   if(!is_valid(f->esp)){
     debug_printf("ERROR: invalid system call frame pointer %p\n", f->esp);
     thread_exit_with_status(-1);
@@ -82,16 +333,10 @@ syscall_handler (struct intr_frame *f UNUSED)
     break;
   }
   case SYS_EXEC:{ // 2
-    const char* cmd_line = GET_ARGUMENT(f->esp, 1, char*);
-
-    // Check the cmd_line one char by one char since strlen will panic 
-    uint32_t addr = (uint32_t)cmd_line;
-    while(is_valid(addr) &&  cmd_line[addr - (uint32_t)cmd_line] != '\0'){
-      ++addr;
-    }
-    if(!is_valid(addr)){
-      debug_printf("ERROR: exec failed due to invalid cmd line %p\n", cmd_line);
-      thread_exit_with_status(-1);
+    char* cmd_line = copy_in_string(GET_ARGUMENT(f->esp, 1, char*));
+    if(!cmd_line){
+      f->eax = TID_ERROR;
+      break;
     }
 
     // Parent procesws
@@ -112,6 +357,7 @@ syscall_handler (struct intr_frame *f UNUSED)
       }
       free(exec_block);
     }
+    palloc_free_page(cmd_line);
 
     f->eax = tid;
     break;
@@ -123,49 +369,43 @@ syscall_handler (struct intr_frame *f UNUSED)
     break;
   }
   case SYS_CREATE:{
-    const char* filename = GET_ARGUMENT(f->esp, 1, char*);
+    char* filename = copy_in_string(GET_ARGUMENT(f->esp, 1, char*));
     unsigned initial_size = GET_ARGUMENT(f->esp, 2, unsigned);
-    if(!is_valid(filename) || !filename){
-      debug_printf("ERROR: opening failed due to invalid filename %p\n", filename);
-      thread_exit_with_status(-1);
-    }
-
-    lock_acquire(&filesys_lock);
-    if(!filesys_create(filename, initial_size)){
+    if(!filename || !filesys_create(filename, initial_size)){
       debug_printf("ERROR: create failed\n");
       f->eax = (uint32_t)false;
     }else{
       f->eax = (uint32_t)true;
     }
-    lock_release(&filesys_lock);
+    if(filename){
+      palloc_free_page(filename);
+    }
     break;
   }
   case SYS_REMOVE:
   {
-    const char* filename = GET_ARGUMENT(f->esp, 1, char*);
-    if(!is_valid(filename) || !filename){
-      debug_printf("ERROR: Removing failed due to invalid filename %p\n", filename);
-      thread_exit_with_status(-1);
+    char* filename = copy_in_string(GET_ARGUMENT(f->esp, 1, char*));
+    if(!filename){
+      f->eax = false;
+      break;
     }
-    
-    lock_acquire(&filesys_lock);
+
     bool success = filesys_remove(filename);
-    lock_release(&filesys_lock);
+    palloc_free_page(filename);
 
     f->eax = success;
     break;
   }
   case SYS_OPEN:{
-    char* filename = GET_ARGUMENT(f->esp, 1, char*);
-    if(!is_valid(filename) || !filename){
-      debug_printf("ERROR: opening failed due to invalid filename %p\n", filename);
-      thread_exit_with_status(-1);
+    char* filename = copy_in_string(GET_ARGUMENT(f->esp, 1, char*));
+    if(!filename){
+      f->eax = -1;
+      break;
     }
 
     uint32_t fd_out;
-    lock_acquire(&filesys_lock);
     bool success = open_file(fd_table, filename, &fd_out);
-    lock_release(&filesys_lock);
+    palloc_free_page(filename);
     if(!success){
       debug_printf("ERROR: failed to open file%p\n", filename);
       f->eax = -1;
@@ -182,10 +422,8 @@ syscall_handler (struct intr_frame *f UNUSED)
       thread_exit_with_status(-1);
     }
 
-    lock_acquire(&filesys_lock);
     debug_printf("size:%d\n", file_length(file));
     f->eax = file_length(file);
-    lock_release(&filesys_lock);
     break;
   }
 
@@ -193,29 +431,12 @@ syscall_handler (struct intr_frame *f UNUSED)
     uint32_t fd = GET_ARGUMENT(f->esp, 1, uint32_t);
     char* buffer = GET_ARGUMENT(f->esp, 2, char*);
     unsigned size = GET_ARGUMENT(f->esp, 3, unsigned);
-    uint32_t size_read = 0;
-    if(!is_valid(buffer)){
+    if(!is_valid_range(buffer, size, true)){
       debug_printf("ERROR: writing failed due to invalid user buffer %p\n", buffer);
       thread_exit_with_status(-1);
     }
-    if(fd == STDIN_FILENO){
-      uint8_t key = input_getc();
-      buffer[0] = key;
-      size_read = 1;
-    }else{
-      struct file* file = get_open_file(fd_table, fd);
-      if(!file){
-        // Failed to get open file
-        debug_printf("ERROR: failed to get open file for fd %d\n", fd);
-        f->eax = READ_ERROR;
-        return;
-      }
-      lock_acquire(&filesys_lock);
-      size_read = file_read(file, buffer, size);
-      lock_release(&filesys_lock);
-    }
-    // debug_printf("expect size: %d, size_read %d\n", size, size_read);
-    f->eax = size_read;
+    f->eax = read_fd(fd_table, fd, buffer, size, -1);
+    unpin_range(buffer, size);
     break;
   }
   case SYS_WRITE:{
@@ -226,33 +447,96 @@ syscall_handler (struct intr_frame *f UNUSED)
       f->eax = 0;
       return;
     }
-
-    uint32_t size_written = 0;
-    if(!is_valid(buffer)){
+    if(!is_valid_range(buffer, size, false)){
       debug_printf("ERROR: writing failed due to invalid user buffer %p\n", buffer);
       thread_exit_with_status(-1);
     }
-    if(fd == STDOUT_FILENO){
-      // printf("size: %d\n", size);
-      int iteration = (size - 1) / CHUNK;
-      for(int i = 0; i <= iteration; ++i){
-        putbuf(buffer + iteration * CHUNK,  size);
+    f->eax = write_fd(fd_table, fd, buffer, size, -1);
+    unpin_range(buffer, size);
+    break;
+  }
+  case SYS_READV:
+  case SYS_WRITEV:{
+    uint32_t fd = GET_ARGUMENT(f->esp, 1, uint32_t);
+    const struct iovec* user_iov = GET_ARGUMENT(f->esp, 2, struct iovec*);
+    int iovcnt = GET_ARGUMENT(f->esp, 3, int);
+    bool reading = syscall_number == SYS_READV;
+    if(iovcnt < 0 || iovcnt > IOV_MAX){
+      f->eax = -1;
+      break;
+    }
+    if(iovcnt == 0){
+      f->eax = 0;
+      break;
+    }
+    if(!reading && fd != STDOUT_FILENO && !get_open_file(fd_table, fd)){
+      // Kill here as write_fd() would, before iov needs freeing
+      debug_printf("ERROR: failed to get open file for fd %d\n", fd);
+      thread_exit_with_status(-1);
+    }
+    // Copy the array in, since pinning a buffer that shares its page may unshare that page
+    struct iovec* iov = malloc(iovcnt * sizeof *iov);
+    if(!iov){
+      f->eax = -1;
+      break;
+    }
+    if(!copy_from_user(iov, user_iov, iovcnt * sizeof *iov)){
+      debug_printf("ERROR: invalid iovec array %p\n", user_iov);
+      free(iov);
+      thread_exit_with_status(-1);
+    }
+
+    // All the buffers in one kernel entry, stopping early like a short read or write
+    int total = 0;
+    for(int i = 0; i < iovcnt; ++i){
+      char* buffer = iov[i].iov_base;
+      unsigned size = iov[i].iov_len;
+      if(size == 0){
+        continue;
       }
-      size_written = size;
-    }else{
-      struct file* file = get_open_file(fd_table, fd);
-      if(!file){
-        // Failed to get open file
-        debug_printf("ERROR: failed to get open file for fd %d\n", fd);
+      if(!is_valid_range(buffer, size, reading)){
+        debug_printf("ERROR: invalid user buffer %p in iovec %d\n", buffer, i);
+        free(iov);
         thread_exit_with_status(-1);
       }
-      lock_acquire(&filesys_lock);
-      size_written = file_write(file, buffer, size);
-      lock_release(&filesys_lock);
-    }      
-
-    f->eax = size_written;
-    // debug_printf("expect size: %d, size_write %d\n", size, size_written);
+      int done = reading ? read_fd(fd_table, fd, buffer, size, -1)
+                         : write_fd(fd_table, fd, buffer, size, -1);
+      unpin_range(buffer, size);
+      if(done < 0){
+        total = total > 0 ? total : -1;
+        break;
+      }
+      total += done;
+      if((unsigned)done < size){
+        break;
+      }
+    }
+    free(iov);
+    f->eax = total;
+    break;
+  }
+  case SYS_PREAD:
+  case SYS_PWRITE:{
+    uint32_t fd = GET_ARGUMENT(f->esp, 1, uint32_t);
+    char* buffer = GET_ARGUMENT(f->esp, 2, char*);
+    unsigned size = GET_ARGUMENT(f->esp, 3, unsigned);
+    off_t position = GET_ARGUMENT(f->esp, 4, off_t);
+    bool reading = syscall_number == SYS_PREAD;
+    if(position < 0){
+      f->eax = -1;
+      break;
+    }
+    if(size == 0){
+      f->eax = 0;
+      break;
+    }
+    if(!is_valid_range(buffer, size, reading)){
+      debug_printf("ERROR: invalid user buffer %p\n", buffer);
+      thread_exit_with_status(-1);
+    }
+    f->eax = reading ? read_fd(fd_table, fd, buffer, size, position)
+                     : write_fd(fd_table, fd, buffer, size, position);
+    unpin_range(buffer, size);
     break;
   }
   case SYS_SEEK:{
@@ -264,9 +548,7 @@ syscall_handler (struct intr_frame *f UNUSED)
       debug_printf("ERROR: failed to get open file for fd %d\n", fd);
       thread_exit_with_status(-1);
     }
-    lock_acquire(&filesys_lock);
     file_seek(file, position);
-    lock_release(&filesys_lock);
     break;
   }
   case SYS_TELL:{
@@ -283,23 +565,106 @@ syscall_handler (struct intr_frame *f UNUSED)
   case SYS_CLOSE:{
     uint32_t fd = GET_ARGUMENT(f->esp, 1, uint32_t);
 
-    lock_acquire(&filesys_lock);
     if(!close_file(fd_table, fd)){
       debug_printf("ERROR: closing file failed %d\n", fd);
-      lock_release(&filesys_lock);
       thread_exit_with_status(-1);
     }
-    lock_release(&filesys_lock);
 
     break;
   }
-  case SYS_MMAP:
-  case SYS_MUNMAP:
-  case SYS_CHDIR:
-  case SYS_MKDIR:
-  case SYS_READDIR:
-  case SYS_ISDIR:
-  case SYS_INUMBER:
+  case SYS_CHDIR:{
+    char* dirname = copy_in_string(GET_ARGUMENT(f->esp, 1, char*));
+    if(!dirname){
+      f->eax = false;
+      break;
+    }
+    f->eax = filesys_chdir(dirname);
+    palloc_free_page(dirname);
+    break;
+  }
+  case SYS_MKDIR:{
+    char* dirname = copy_in_string(GET_ARGUMENT(f->esp, 1, char*));
+    if(!dirname){
+      f->eax = false;
+      break;
+    }
+    f->eax = filesys_mkdir(dirname);
+    palloc_free_page(dirname);
+    break;
+  }
+  case SYS_READDIR:{
+    uint32_t fd = GET_ARGUMENT(f->esp, 1, uint32_t);
+    char* name = GET_ARGUMENT(f->esp, 2, char*);
+    char kname[NAME_MAX + 1];
+    struct dir* dir = get_open_dir(fd_table, fd);
+    f->eax = dir != NULL && dir_readdir(dir, kname);
+    if(f->eax && !copy_to_user(name, kname, strlen(kname) + 1)){
+      debug_printf("ERROR: readdir failed due to invalid user buffer %p\n", name);
+      thread_exit_with_status(-1);
+    }
+    break;
+  }
+  case SYS_ISDIR:{
+    uint32_t fd = GET_ARGUMENT(f->esp, 1, uint32_t);
+    if(!get_open_file(fd_table, fd)){
+      debug_printf("ERROR: failed to get open file for fd %d\n", fd);
+      thread_exit_with_status(-1);
+    }
+    f->eax = get_open_dir(fd_table, fd) != NULL;
+    break;
+  }
+  case SYS_INUMBER:{
+    uint32_t fd = GET_ARGUMENT(f->esp, 1, uint32_t);
+    struct file* file = get_open_file(fd_table, fd);
+    if(!file){
+      debug_printf("ERROR: failed to get open file for fd %d\n", fd);
+      thread_exit_with_status(-1);
+    }
+    f->eax = inode_get_inumber(file_get_inode(file));
+    break;
+  }
+#ifdef VM
+  case SYS_MMAP:{
+    uint32_t fd = GET_ARGUMENT(f->esp, 1, uint32_t);
+    void* addr = GET_ARGUMENT(f->esp, 2, void*);
+    struct file* file = get_open_file(fd_table, fd);
+    if(!file || get_open_dir(fd_table, fd)){
+      debug_printf("ERROR: cannot map fd %d\n", fd);
+      f->eax = MAP_FAILED;
+      break;
+    }
+    f->eax = mmap_map(file, addr);
+    break;
+  }
+  case SYS_MUNMAP:{
+    mapid_t mapping = GET_ARGUMENT(f->esp, 1, mapid_t);
+    if(!mmap_unmap(mapping)){
+      debug_printf("ERROR: no mapping %d\n", mapping);
+    }
+    break;
+  }
+  case SYS_FORK:{
+    // The child copies this process while we wait, then signals like exec
+    struct exec_block_t* exec_block = thread_create_exec_block(current_thread->tid, false);
+    tid_t tid = process_fork(f);
+    if(tid != TID_ERROR){
+      sema_down(&exec_block->exec_sem);
+      tid = exec_block->status == THREAD_KILLED ? TID_ERROR : tid;
+    }
+    if(tid == TID_ERROR){
+      debug_printf("Fork Failed\n");
+      list_remove(&exec_block->list_elem);
+      if(exec_block->command){
+        free(exec_block->command);
+        exec_block->command = NULL;
+      }
+      free(exec_block);
+    }
+
+    f->eax = tid;
+    break;
+  }
+#endif
   default:
     debug_printf ("ERROR: system call %d not implemented \n", syscall_number );
     thread_exit_with_status(-1);
@@ -0,0 +1,179 @@
+#include "vm/frame.h"
+#include <debug.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "userprog/pagedir.h"
+#include "vm/page.h"
+#include "vm/share.h"
+
+/* The frame table lists every frame of the user pool that holds
+   a user page.  When the pool runs out, a frame is taken from
+   another page, chosen with the clock (second chance) algorithm:
+   the hand sweeps the table, clearing the accessed bit of each
+   page it passes, and stops at a page that has not been accessed
+   since the last sweep.  A shared frame counts as accessed if any
+   of the processes that map it accessed it. */
+
+static struct list frames;              /* All frames in use. */
+static size_t frame_cnt;                /* Number of frames in use. */
+static struct list_elem *hand;          /* Next frame the clock looks at,
+                                           or null for the first. */
+static struct lock frame_lock;          /* Protects the above. */
+
+static struct frame *evict (void);
+
+/* Initializes the frame table. */
+void
+frame_init (void)
+{
+  list_init (&frames);
+  frame_cnt = 0;
+  hand = NULL;
+  lock_init (&frame_lock);
+}
+
+/* Returns a frame, evicting another page if the user pool is
+   exhausted.  The frame is pinned once and holds nothing; the
+   caller, holding the lock of the page or share it is for, sets
+   its PAGE or SHARE and unpins it once the contents are in it.
+   Returns a null pointer if no frame can be found. */
+struct frame *
+frame_alloc (void)
+{
+  struct frame *f;
+  void *kpage;
+
+  kpage = palloc_get_page (PAL_USER);
+  if (kpage == NULL)
+    return evict ();
+
+  f = malloc (sizeof *f);
+  if (f == NULL)
+    {
+      palloc_free_page (kpage);
+      return NULL;
+    }
+  f->kpage = kpage;
+  f->page = NULL;
+  f->share = NULL;
+  f->pin_cnt = 1;
+
+  lock_acquire (&frame_lock);
+  list_push_back (&frames, &f->elem);
+  frame_cnt++;
+  lock_release (&frame_lock);
+  return f;
+}
+
+/* Frees frame F and the memory it holds.  The lock of the page or
+   share in F must be held. */
+void
+frame_free (struct frame *f)
+{
+  lock_acquire (&frame_lock);
+  if (hand == &f->elem)
+    hand = list_next (hand);
+  list_remove (&f->elem);
+  frame_cnt--;
+  lock_release (&frame_lock);
+
+  palloc_free_page (f->kpage);
+  free (f);
+}
+
+/* Advances the clock hand and returns the frame it was on.
+   Must be called with frame_lock held and the table not empty. */
+static struct frame *
+next_frame (void)
+{
+  struct frame *f;
+
+  if (hand == NULL || hand == list_end (&frames))
+    hand = list_begin (&frames);
+  f = list_entry (hand, struct frame, elem);
+  hand = list_next (hand);
+  return f;
+}
+
+/* Returns the lock of the page or share in F. */
+static struct lock *
+holder_lock (struct frame *f)
+{
+  return f->share != NULL ? &f->share->lock : &f->page->lock;
+}
+
+/* Returns true if the page in F was accessed since the last call,
+   and clears its accessed bits.  The lock of the page or share in
+   F must be held. */
+static bool
+accessed (struct frame *f)
+{
+  struct page *p = f->page;
+  uint32_t *pd;
+
+  if (f->share != NULL)
+    return share_accessed (f->share);
+
+  pd = p->thread->pagedir;
+  if (!pagedir_is_accessed (pd, p->upage))
+    return false;
+  pagedir_set_accessed (pd, p->upage, false);
+  return true;
+}
+
+/* Takes a frame away from some other page.  Returns the frame,
+   pinned and holding nothing, or a null pointer if every frame is
+   pinned or busy, or no page could be written out. */
+static struct frame *
+evict (void)
+{
+  size_t i;
+
+  lock_acquire (&frame_lock);
+
+  /* Two sweeps give every page a second chance. */
+  for (i = 0; i < 2 * frame_cnt; i++)
+    {
+      struct frame *f = next_frame ();
+      struct lock *lock;
+      bool evicted;
+
+      /* Skip frames in use or being loaded, evicted or freed. */
+      if (f->pin_cnt > 0)
+        continue;
+      lock = holder_lock (f);
+      if (!lock_try_acquire (lock))
+        continue;
+
+      /* F may have been pinned, or handed to another holder,
+         before the lock was had. */
+      if (f->pin_cnt > 0 || holder_lock (f) != lock || accessed (f))
+        {
+          lock_release (lock);
+          continue;
+        }
+
+      /* Write the victim out without holding up the frame
+         table. */
+      f->pin_cnt = 1;
+      lock_release (&frame_lock);
+      evicted = (f->share != NULL
+                 ? share_evict (f->share)
+                 : page_evict (f->page));
+      if (evicted)
+        {
+          f->page = NULL;
+          f->share = NULL;
+          lock_release (lock);
+          return f;
+        }
+      f->pin_cnt = 0;
+      lock_release (lock);
+      lock_acquire (&frame_lock);
+    }
+
+  lock_release (&frame_lock);
+  return NULL;
+}
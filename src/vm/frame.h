@@ -0,0 +1,31 @@
+#ifndef VM_FRAME_H
+#define VM_FRAME_H
+
+#include <list.h>
+#include <stdbool.h>
+
+struct page;
+struct share;
+
+/* A frame of the user pool holding a user page.
+
+   A frame holds either one process's private PAGE or a SHARE,
+   a read-only page that several processes may have mapped.  The
+   members below ELEM and KPAGE are protected by the lock of the
+   page or share held.  The clock also reads them, with frame_lock
+   held, to pick a victim, but only evicts a frame after acquiring
+   that lock. */
+struct frame
+  {
+    struct list_elem elem;              /* Element in frame table. */
+    void *kpage;                        /* Kernel virtual address. */
+    struct page *page;                  /* Private page held, or null. */
+    struct share *share;                /* Shared page held, or null. */
+    int pin_cnt;                        /* Evictable only if 0. */
+  };
+
+void frame_init (void);
+struct frame *frame_alloc (void);
+void frame_free (struct frame *);
+
+#endif /* vm/frame.h */
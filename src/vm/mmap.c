@@ -0,0 +1,133 @@
+#include "vm/mmap.h"
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "vm/page.h"
+
+/* A memory-mapped file.  Its pages are entries in the process's
+   supplemental page table (see page.c), which reads them from the
+   file when they are first touched and writes them back if they
+   are modified. */
+struct mapping
+  {
+    struct list_elem elem;              /* Element in thread's list. */
+    mapid_t id;                         /* Mapping identifier. */
+    struct file *file;                  /* File mapped. */
+    uint8_t *addr;                      /* First page of the mapping. */
+    size_t page_cnt;                    /* Number of pages. */
+  };
+
+static struct mapping *find_mapping (mapid_t);
+static void unmap (struct mapping *);
+
+/* Maps the whole of FILE into the running process's address
+   space at ADDR, which must be page-aligned.  The mapping keeps
+   its own handle to FILE, so FILE may be closed afterward.
+   Returns the new mapping's identifier, or MAP_FAILED if FILE is
+   empty, ADDR is null, or the mapping would overlap pages already
+   in use. */
+mapid_t
+mmap_map (struct file *file, void *addr)
+{
+  struct thread *t = thread_current ();
+  struct mapping *m;
+  off_t length;
+  size_t i;
+
+  length = file_length (file);
+  if (addr == NULL || pg_ofs (addr) != 0 || length == 0)
+    return MAP_FAILED;
+
+  m = malloc (sizeof *m);
+  if (m == NULL)
+    return MAP_FAILED;
+  m->file = file_reopen (file);
+  if (m->file == NULL)
+    {
+      free (m);
+      return MAP_FAILED;
+    }
+  m->addr = addr;
+  m->page_cnt = DIV_ROUND_UP (length, PGSIZE);
+
+  for (i = 0; i < m->page_cnt; i++)
+    {
+      uint8_t *upage = m->addr + i * PGSIZE;
+      off_t ofs = i * PGSIZE;
+      size_t read_bytes = length - ofs < PGSIZE ? length - ofs : PGSIZE;
+
+      if (!is_user_vaddr (upage)
+          || !page_add_mmap (upage, m->file, ofs, read_bytes))
+        {
+          while (i-- > 0)
+            page_remove (m->addr + i * PGSIZE);
+          file_close (m->file);
+          free (m);
+          return MAP_FAILED;
+        }
+    }
+
+  m->id = t->next_mapid++;
+  list_push_back (&t->mappings, &m->elem);
+  return m->id;
+}
+
+/* Unmaps the running process's mapping ID, writing back the pages
+   that were modified.  Returns false if there is no such
+   mapping. */
+bool
+mmap_unmap (mapid_t id)
+{
+  struct mapping *m = find_mapping (id);
+
+  if (m == NULL)
+    return false;
+  unmap (m);
+  return true;
+}
+
+/* Unmaps all of the running process's mappings. */
+void
+mmap_unmap_all (void)
+{
+  struct thread *t = thread_current ();
+
+  while (!list_empty (&t->mappings))
+    unmap (list_entry (list_front (&t->mappings), struct mapping, elem));
+}
+
+/* Returns the running process's mapping ID, or a null pointer if
+   there is none. */
+static struct mapping *
+find_mapping (mapid_t id)
+{
+  struct thread *t = thread_current ();
+  struct list_elem *e;
+
+  for (e = list_begin (&t->mappings); e != list_end (&t->mappings);
+       e = list_next (e))
+    {
+      struct mapping *m = list_entry (e, struct mapping, elem);
+      if (m->id == id)
+        return m;
+    }
+  return NULL;
+}
+
+/* Removes M's pages, writing back those that were modified, and
+   frees M. */
+static void
+unmap (struct mapping *m)
+{
+  size_t i;
+
+  for (i = 0; i < m->page_cnt; i++)
+    page_remove (m->addr + i * PGSIZE);
+  list_remove (&m->elem);
+  file_close (m->file);
+  free (m);
+}
@@ -0,0 +1,544 @@
+#include "vm/page.h"
+#include <debug.h>
+#include <string.h>
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "vm/frame.h"
+#include "vm/share.h"
+#include "vm/swap.h"
+
+/* Pages are not brought into memory until the process first
+   touches them.  The page fault handler calls page_load(), which
+   looks the faulting address up in the running thread's
+   supplemental page table, fills a frame as the table says, and
+   maps it.
+
+   When the frame table takes a page's frame away (see frame.c),
+   page_evict() writes the page to swap if it was modified since
+   it was last read in, and otherwise simply drops it, since it
+   can be read again from where it first came from.  A page read
+   back from swap is marked dirty, so that it is written out again
+   the next time it is evicted.
+
+   The read-only pages of an executable are shared among all the
+   processes running it (see share.c).  They have no frame or swap
+   slot of their own.  So are the modified pages of a process
+   that forked, until the parent or the child writes to them.
+
+   A page of a memory-mapped file never goes to swap.  If it was
+   modified, it is written back to the file instead, both when it
+   is evicted and when it is unmapped. */
+
+static unsigned page_hash (const struct hash_elem *, void *aux);
+static bool page_less (const struct hash_elem *, const struct hash_elem *,
+                       void *aux);
+static void page_free (struct hash_elem *, void *aux);
+static struct page *add_page (void *upage, struct file *, off_t ofs,
+                               size_t read_bytes, bool writable);
+static bool copy_page (struct page *);
+static bool unshare (struct page *);
+static bool bring_in (struct page *, bool pin);
+static struct frame *load (struct page *);
+static void release (struct page *);
+
+/* Creates an empty supplemental page table for the running
+   thread.  Returns false if memory allocation fails. */
+bool
+page_table_create (void)
+{
+  struct thread *t = thread_current ();
+
+  ASSERT (t->pages == NULL);
+
+  t->pages = malloc (sizeof *t->pages);
+  if (t->pages == NULL)
+    return false;
+  if (!hash_init (t->pages, page_hash, page_less, NULL))
+    {
+      free (t->pages);
+      t->pages = NULL;
+      return false;
+    }
+  return true;
+}
+
+/* Destroys the running thread's supplemental page table, if it
+   has one, and frees its pages' frames and swap slots.  Must be
+   called before the thread's page directory is destroyed. */
+void
+page_table_destroy (void)
+{
+  struct thread *t = thread_current ();
+
+  if (t->pages != NULL)
+    {
+      hash_destroy (t->pages, page_free);
+      free (t->pages);
+      t->pages = NULL;
+    }
+}
+
+/* Gives the running thread, just forked from PARENT, a copy of
+   PARENT's address space, except for its memory-mapped files.
+   PARENT must be blocked until this returns.  Pages that PARENT
+   has modified are shared copy-on-write; the others are read
+   again from where they first came from.  The running thread's
+   EXEC_FILE must already be a handle to PARENT's.  Returns false
+   if memory allocation fails. */
+bool
+page_table_copy (struct thread *parent)
+{
+  struct hash_iterator i;
+
+  hash_first (&i, parent->pages);
+  while (hash_next (&i))
+    {
+      struct page *p = hash_entry (hash_cur (&i), struct page, hash_elem);
+      if (!p->mmapped && !copy_page (p))
+        return false;
+    }
+  return true;
+}
+
+/* Records that the page at UPAGE in the running thread's address
+   space is to hold READ_BYTES bytes of FILE starting at OFS,
+   followed by zeros, and is writable by the process if WRITABLE
+   is true.  FILE may be null if READ_BYTES is 0.  FILE must stay
+   open as long as the page exists.  A read-only page of FILE is
+   shared with every other process that has the same part of the
+   same file as a read-only page.  Returns false if UPAGE is
+   already in use or memory allocation fails. */
+bool
+page_add_file (void *upage, struct file *file, off_t ofs,
+               size_t read_bytes, bool writable)
+{
+  return add_page (upage, file, ofs, read_bytes, writable) != NULL;
+}
+
+/* Records that the page at UPAGE in the running thread's address
+   space maps the READ_BYTES bytes of FILE starting at OFS, so that
+   changes to it go back to FILE.  FILE must stay open as long as
+   the page exists.  Returns false if UPAGE is already in use or
+   memory allocation fails. */
+bool
+page_add_mmap (void *upage, struct file *file, off_t ofs,
+               size_t read_bytes)
+{
+  struct page *p;
+
+  ASSERT (file != NULL);
+
+  p = add_page (upage, file, ofs, read_bytes, true);
+  if (p == NULL)
+    return false;
+  p->mmapped = true;
+  return true;
+}
+
+/* Removes the running thread's page at UPAGE from its address
+   space, writing it back first if it is part of a memory-mapped
+   file and was modified. */
+void
+page_remove (void *upage)
+{
+  struct page *p = page_lookup (upage);
+
+  ASSERT (p != NULL);
+
+  hash_delete (thread_current ()->pages, &p->hash_elem);
+  release (p);
+}
+
+/* If ADDR, a user address accessed while the user stack pointer
+   was ESP, may be part of the stack but is not yet part of the
+   running thread's address space, adds a zeroed page for it.
+   Addresses down to 32 bytes below ESP count, because PUSHA
+   writes that far below the stack pointer before adjusting it.
+   Returns true if a page was added. */
+bool
+page_extend_stack (const void *addr, const void *esp)
+{
+  if (!is_user_vaddr (addr)
+      || (uint8_t *) addr < (uint8_t *) PHYS_BASE - STACK_MAX
+      || (uint8_t *) addr + 32 < (uint8_t *) esp
+      || page_lookup (addr) != NULL)
+    return false;
+  return page_add_file (pg_round_down (addr), NULL, 0, 0, true);
+}
+
+/* Returns the running thread's page at UPAGE, or a null pointer
+   if there is none. */
+struct page *
+page_lookup (const void *upage)
+{
+  struct thread *t = thread_current ();
+  struct page key;
+  struct hash_elem *e;
+
+  if (t->pages == NULL)
+    return NULL;
+  key.upage = pg_round_down (upage);
+  e = hash_find (t->pages, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct page, hash_elem) : NULL;
+}
+
+/* Brings the page that contains user address ADDR into memory
+   and maps it.  Returns false if ADDR is not part of the running
+   thread's address space, if no frame can be had, or if the file
+   cannot be read. */
+bool
+page_load (const void *addr)
+{
+  struct page *p = page_lookup (addr);
+  return p != NULL && bring_in (p, false);
+}
+
+/* Brings the page that contains user address ADDR into memory
+   and keeps it there until page_unpin() is called, so that the
+   kernel can use it without faulting.  If WRITE is true, the
+   kernel is going to write to the page, so a read-only page is
+   refused and a page shared copy-on-write is copied first.
+   Returns false on the same conditions as page_load(). */
+bool
+page_pin (const void *addr, bool write)
+{
+  struct page *p = page_lookup (addr);
+
+  if (p == NULL || (write && !p->writable))
+    return false;
+  if (write && p->share != NULL && !unshare (p))
+    return false;
+  return bring_in (p, true);
+}
+
+/* Gives the running thread a private copy of the page that
+   contains user address ADDR, if that page is writable but shared
+   copy-on-write since a fork.  Returns false if there is no such
+   page or no frame for the copy. */
+bool
+page_unshare (const void *addr)
+{
+  struct page *p = page_lookup (addr);
+  return p != NULL && p->writable && p->share != NULL && unshare (p);
+}
+
+/* Lets the page that contains user address ADDR, pinned with
+   page_pin(), be evicted again. */
+void
+page_unpin (const void *addr)
+{
+  struct page *p = page_lookup (addr);
+
+  ASSERT (p != NULL);
+
+  if (p->share != NULL)
+    {
+      share_unpin (p->share);
+      return;
+    }
+  lock_acquire (&p->lock);
+  ASSERT (p->frame != NULL && p->frame->pin_cnt > 0);
+  p->frame->pin_cnt--;
+  lock_release (&p->lock);
+}
+
+/* Writes P out so that its frame can be given to another page.
+   P's lock must be held and its frame pinned.  Returns false,
+   leaving P in its frame, if P needs to go to swap and swap is
+   full. */
+bool
+page_evict (struct page *p)
+{
+  uint32_t *pd = p->thread->pagedir;
+
+  ASSERT (lock_held_by_current_thread (&p->lock));
+  ASSERT (p->share == NULL);
+  ASSERT (p->frame != NULL);
+
+  /* Unmap P first, so that the owner cannot modify it while it is
+     written out.  If the owner touches it in the meantime, it
+     waits in page_load() for P's lock. */
+  pagedir_clear_page (pd, p->upage);
+  if (p->mmapped)
+    {
+      if (pagedir_is_dirty (pd, p->upage))
+        file_write_at (p->file, p->frame->kpage, p->read_bytes,
+                       p->file_ofs);
+    }
+  else if (pagedir_is_dirty (pd, p->upage)
+           && !swap_out (p->frame->kpage, &p->swap_slot))
+    {
+      pagedir_set_page (pd, p->upage, p->frame->kpage, p->writable);
+      pagedir_set_dirty (pd, p->upage, true);
+      return false;
+    }
+  p->frame = NULL;
+  return true;
+}
+
+/* Adds to the running thread's page table a copy of page P of a
+   blocked parent process.  A page whose contents exist only in
+   memory or in swap becomes shared between the two processes.
+   Returns false if memory allocation fails. */
+static bool
+copy_page (struct page *p)
+{
+  struct thread *t = thread_current ();
+  struct page *c;
+  struct share *s;
+
+  c = add_page (p->upage, p->file != NULL ? t->exec_file : NULL,
+                p->file_ofs, p->read_bytes, p->writable);
+  if (c == NULL)
+    return false;
+
+  /* A read-only page of the executable was shared by add_page(). */
+  if (!p->writable)
+    return true;
+
+  lock_acquire (&p->lock);
+  s = p->share;
+  if (s == NULL
+      && (p->swap_slot != SWAP_NONE
+          || (p->frame != NULL
+              && pagedir_is_dirty (p->thread->pagedir, p->upage))))
+    {
+      s = share_adopt (p);
+      if (s == NULL)
+        {
+          lock_release (&p->lock);
+          return false;
+        }
+    }
+  if (s != NULL)
+    {
+      share_ref (s);
+      c->share = s;
+    }
+  lock_release (&p->lock);
+  return true;
+}
+
+/* Gives P, a writable page of the running thread that is shared
+   copy-on-write, a private copy in a frame of its own and maps it
+   writable.  Returns false if no frame can be had. */
+static bool
+unshare (struct page *p)
+{
+  uint32_t *pd = p->thread->pagedir;
+  struct frame *f;
+
+  lock_acquire (&p->lock);
+  f = share_copy (p->share, p);
+  if (f == NULL)
+    {
+      lock_release (&p->lock);
+      return false;
+    }
+  p->share = NULL;
+  f->page = p;
+  if (!pagedir_set_page (pd, p->upage, f->kpage, true))
+    {
+      /* The page is lost, so the process cannot go on. */
+      frame_free (f);
+      lock_release (&p->lock);
+      return false;
+    }
+  /* The copy exists nowhere else, so it must go to swap if it is
+     evicted. */
+  pagedir_set_dirty (pd, p->upage, true);
+  p->frame = f;
+  f->pin_cnt--;
+  lock_release (&p->lock);
+  return true;
+}
+
+/* Brings P into memory and maps it.  If PIN is true, also pins
+   its frame once more.  Returns false on failure. */
+static bool
+bring_in (struct page *p, bool pin)
+{
+  struct frame *f;
+
+  if (p->share != NULL)
+    {
+      f = share_load (p->share, p);
+      if (f != NULL && !pin)
+        share_unpin (p->share);
+      return f != NULL;
+    }
+
+  lock_acquire (&p->lock);
+  f = load (p);
+  if (f != NULL && !pin)
+    f->pin_cnt--;
+  lock_release (&p->lock);
+  return f != NULL;
+}
+
+/* Puts private page P, whose lock must be held, into a frame if
+   it is not in one already and maps it.  Returns P's frame,
+   pinned once more, or a null pointer on failure. */
+static struct frame *
+load (struct page *p)
+{
+  uint32_t *pd = p->thread->pagedir;
+  bool from_swap = p->swap_slot != SWAP_NONE;
+  struct frame *f;
+
+  if (p->frame != NULL)
+    {
+      p->frame->pin_cnt++;
+      return p->frame;
+    }
+
+  f = frame_alloc ();
+  if (f == NULL)
+    return NULL;
+  f->page = p;
+
+  if (from_swap)
+    {
+      swap_in (p->swap_slot, f->kpage);
+      p->swap_slot = SWAP_NONE;
+    }
+  else
+    {
+      if (p->read_bytes > 0
+          && file_read_at (p->file, f->kpage, p->read_bytes, p->file_ofs)
+             != (off_t) p->read_bytes)
+        {
+          frame_free (f);
+          return NULL;
+        }
+      memset ((uint8_t *) f->kpage + p->read_bytes, 0,
+              PGSIZE - p->read_bytes);
+    }
+
+  if (!pagedir_set_page (pd, p->upage, f->kpage, p->writable))
+    {
+      /* Out of memory for a page table.  A page read from swap is
+         lost, which only matters if the process could go on. */
+      frame_free (f);
+      return NULL;
+    }
+  /* The copy in swap is gone, so the page must go back there if it
+     is evicted again. */
+  if (from_swap)
+    pagedir_set_dirty (pd, p->upage, true);
+  p->frame = f;
+  return f;
+}
+
+/* Adds a page to the running thread's page table as described
+   for page_add_file() and returns it, or returns a null pointer on
+   failure. */
+static struct page *
+add_page (void *upage, struct file *file, off_t ofs, size_t read_bytes,
+          bool writable)
+{
+  struct thread *t = thread_current ();
+  struct page *p;
+
+  ASSERT (pg_ofs (upage) == 0);
+  ASSERT (read_bytes <= PGSIZE);
+  ASSERT (file != NULL || read_bytes == 0);
+
+  if (pagedir_get_page (t->pagedir, upage) != NULL)
+    return NULL;
+
+  p = malloc (sizeof *p);
+  if (p == NULL)
+    return NULL;
+  p->upage = upage;
+  p->writable = writable;
+  p->mmapped = false;
+  p->file = file;
+  p->file_ofs = ofs;
+  p->read_bytes = read_bytes;
+  p->thread = t;
+  lock_init (&p->lock);
+  p->frame = NULL;
+  p->swap_slot = SWAP_NONE;
+  p->share = NULL;
+  p->share_mapped = false;
+  if (!writable && file != NULL)
+    {
+      p->share = share_get (file, ofs, read_bytes);
+      if (p->share == NULL)
+        {
+          free (p);
+          return NULL;
+        }
+    }
+  if (hash_insert (t->pages, &p->hash_elem) != NULL)
+    {
+      if (p->share != NULL)
+        share_put (p->share, p);
+      free (p);
+      return NULL;
+    }
+  return p;
+}
+
+/* Frees P, which is no longer in any page table, along with its
+   frame and swap slot.  If P is part of a memory-mapped file and
+   was modified, writes it back first. */
+static void
+release (struct page *p)
+{
+  uint32_t *pd = p->thread->pagedir;
+
+  if (p->share != NULL)
+    {
+      share_put (p->share, p);
+      free (p);
+      return;
+    }
+
+  /* Wait for any eviction of P to finish. */
+  lock_acquire (&p->lock);
+  if (p->frame != NULL)
+    {
+      pagedir_clear_page (pd, p->upage);
+      if (p->mmapped && pagedir_is_dirty (pd, p->upage))
+        file_write_at (p->file, p->frame->kpage, p->read_bytes,
+                       p->file_ofs);
+      frame_free (p->frame);
+    }
+  if (p->swap_slot != SWAP_NONE)
+    swap_free (p->swap_slot);
+  lock_release (&p->lock);
+  free (p);
+}
+
+/* Returns the page that contains hash element E. */
+static struct page *
+hash_elem_to_page (const struct hash_elem *e)
+{
+  return hash_entry (e, struct page, hash_elem);
+}
+
+static unsigned
+page_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_bytes (&hash_elem_to_page (e)->upage, sizeof (void *));
+}
+
+static bool
+page_less (const struct hash_elem *a, const struct hash_elem *b,
+           void *aux UNUSED)
+{
+  return hash_elem_to_page (a)->upage < hash_elem_to_page (b)->upage;
+}
+
+/* Frees the page that contains hash element E. */
+static void
+page_free (struct hash_elem *e, void *aux UNUSED)
+{
+  release (hash_elem_to_page (e));
+}
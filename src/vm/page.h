@@ -0,0 +1,71 @@
+#ifndef VM_PAGE_H
+#define VM_PAGE_H
+
+#include <hash.h>
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "filesys/off_t.h"
+#include "threads/synch.h"
+
+struct file;
+struct thread;
+
+/* Largest size the user stack may grow to, in bytes. */
+#define STACK_MAX (8 * 1024 * 1024)
+
+/* A page of a process's virtual address space, as recorded in
+   its supplemental page table.  The page table says where a page
+   is mapped while it is in a frame; this says where its contents
+   are the rest of the time.
+
+   LOCK serializes loading, evicting and freeing the page.  The
+   members below it are protected by LOCK. */
+struct page
+  {
+    struct hash_elem hash_elem;         /* Element in page table. */
+    void *upage;                        /* User virtual address. */
+    struct thread *thread;              /* Owning thread. */
+    bool writable;                      /* May the process write it? */
+    bool mmapped;                       /* Part of a memory-mapped file? */
+
+    /* Initial contents: READ_BYTES bytes of FILE starting at
+       FILE_OFS, followed by zeros.  FILE is null for a page that
+       starts out all zeros.  A memory-mapped page is written back
+       to the same place. */
+    struct file *file;
+    off_t file_ofs;
+    size_t read_bytes;
+
+    struct lock lock;
+    struct frame *frame;                /* Frame holding the page, or
+                                           null. */
+    size_t swap_slot;                   /* Swap slot holding the page,
+                                           or SWAP_NONE. */
+
+    /* For a shared page, the frame is SHARE's rather than the
+       page's own.  SHARE_ELEM and SHARE_MAPPED are protected by
+       SHARE's lock. */
+    struct share *share;                /* Shared page, or null. */
+    struct list_elem share_elem;        /* Element in SHARE's pages. */
+    bool share_mapped;                  /* Mapped to SHARE's frame? */
+  };
+
+bool page_table_create (void);
+void page_table_destroy (void);
+bool page_table_copy (struct thread *parent);
+
+bool page_add_file (void *upage, struct file *, off_t ofs,
+                    size_t read_bytes, bool writable);
+bool page_add_mmap (void *upage, struct file *, off_t ofs,
+                    size_t read_bytes);
+void page_remove (void *upage);
+bool page_extend_stack (const void *addr, const void *esp);
+struct page *page_lookup (const void *upage);
+bool page_load (const void *addr);
+bool page_pin (const void *addr, bool write);
+bool page_unshare (const void *addr);
+void page_unpin (const void *addr);
+bool page_evict (struct page *);
+
+#endif /* vm/page.h */
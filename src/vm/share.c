@@ -0,0 +1,375 @@
+#include "vm/share.h"
+#include <debug.h>
+#include <string.h>
+#include "filesys/file.h"
+#include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "vm/frame.h"
+#include "vm/page.h"
+#include "vm/swap.h"
+
+/* Every process running an executable has a page for each page
+   of its read-only segments.  Rather than each reading its own
+   copy, all the pages for one part of one executable refer to a
+   single share, found by the executable's inode sector and the
+   offset, and are mapped read-only to the share's frame.
+
+   A share lives as long as some page refers to it.  It is read
+   in when the first of them is touched.  When its frame is
+   evicted, it is unmapped from every process at once; it is
+   never dirty, so it is simply read again when next touched.
+
+   fork() turns each modified page of the parent into an
+   anonymous share that the parent and the child both refer to.
+   Since every page is mapped to a share read-only, the first
+   write to it faults, and the writer takes a private copy with
+   share_copy().  The last page to leave an anonymous share takes
+   its frame instead of copying it.  An anonymous share cannot be
+   read again, so it is written to swap when it is evicted. */
+
+static struct hash shares;              /* All shares. */
+static struct lock shares_lock;         /* Protects SHARES. */
+
+static unsigned share_hash (const struct hash_elem *, void *aux);
+static bool share_less (const struct hash_elem *, const struct hash_elem *,
+                        void *aux);
+
+/* Initializes the table of shares. */
+void
+share_init (void)
+{
+  if (!hash_init (&shares, share_hash, share_less, NULL))
+    PANIC ("share: hash table creation failed");
+  lock_init (&shares_lock);
+}
+
+/* Returns the share for the page made of READ_BYTES bytes of FILE
+   starting at OFS followed by zeros, creating it if there is
+   none, and counts one more reference to it.  Returns a null
+   pointer if memory allocation fails. */
+struct share *
+share_get (struct file *file, off_t ofs, size_t read_bytes)
+{
+  struct share key, *s;
+  struct hash_elem *e;
+
+  key.sector = inode_get_inumber (file_get_inode (file));
+  key.file_ofs = ofs;
+  key.read_bytes = read_bytes;
+
+  lock_acquire (&shares_lock);
+  e = hash_find (&shares, &key.hash_elem);
+  if (e != NULL)
+    {
+      s = hash_entry (e, struct share, hash_elem);
+      s->ref_cnt++;
+      lock_release (&shares_lock);
+      return s;
+    }
+
+  s = malloc (sizeof *s);
+  if (s != NULL)
+    {
+      s->file = file_reopen (file);
+      if (s->file == NULL)
+        {
+          free (s);
+          s = NULL;
+        }
+    }
+  if (s != NULL)
+    {
+      s->sector = key.sector;
+      s->file_ofs = ofs;
+      s->read_bytes = read_bytes;
+      s->ref_cnt = 1;
+      lock_init (&s->lock);
+      s->frame = NULL;
+      list_init (&s->pages);
+      s->swap_slot = SWAP_NONE;
+      hash_insert (&shares, &s->hash_elem);
+    }
+  lock_release (&shares_lock);
+  return s;
+}
+
+/* Turns private page P, whose lock must be held and whose
+   contents are in a frame or in swap, into an anonymous share
+   that P refers to, and maps P's frame read-only.  P keeps no
+   frame or swap slot of its own.  Returns the share, or a null
+   pointer if memory allocation fails. */
+struct share *
+share_adopt (struct page *p)
+{
+  struct share *s;
+
+  ASSERT (lock_held_by_current_thread (&p->lock));
+  ASSERT (p->share == NULL);
+  ASSERT (p->frame != NULL || p->swap_slot != SWAP_NONE);
+
+  s = malloc (sizeof *s);
+  if (s == NULL)
+    return NULL;
+  s->sector = 0;
+  s->file_ofs = 0;
+  s->read_bytes = PGSIZE;
+  s->file = NULL;
+  s->ref_cnt = 1;
+  lock_init (&s->lock);
+  s->frame = p->frame;
+  list_init (&s->pages);
+  s->swap_slot = p->swap_slot;
+
+  if (s->frame != NULL)
+    {
+      uint32_t *pd = p->thread->pagedir;
+
+      /* The clock rechecks who holds a frame after it acquires
+         the holder's lock, and P's lock is held, so it cannot get
+         in the way. */
+      s->frame->page = NULL;
+      s->frame->share = s;
+      pagedir_clear_page (pd, p->upage);
+      pagedir_set_page (pd, p->upage, s->frame->kpage, false);
+      list_push_back (&s->pages, &p->share_elem);
+      p->share_mapped = true;
+    }
+  p->frame = NULL;
+  p->swap_slot = SWAP_NONE;
+  p->share = s;
+  return s;
+}
+
+/* Counts one more reference to S. */
+void
+share_ref (struct share *s)
+{
+  lock_acquire (&shares_lock);
+  s->ref_cnt++;
+  lock_release (&shares_lock);
+}
+
+/* Drops page P's reference to S, unmapping P if it is mapped.
+   Frees S if that was the last reference. */
+void
+share_put (struct share *s, struct page *p)
+{
+  bool last;
+
+  lock_acquire (&s->lock);
+  if (p->share_mapped)
+    {
+      pagedir_clear_page (p->thread->pagedir, p->upage);
+      list_remove (&p->share_elem);
+      p->share_mapped = false;
+    }
+  lock_release (&s->lock);
+
+  lock_acquire (&shares_lock);
+  last = --s->ref_cnt == 0;
+  if (last && s->file != NULL)
+    hash_delete (&shares, &s->hash_elem);
+  lock_release (&shares_lock);
+
+  if (last)
+    {
+      /* Nobody can find S any more, but the clock may still be
+         evicting it. */
+      lock_acquire (&s->lock);
+      if (s->frame != NULL)
+        frame_free (s->frame);
+      if (s->swap_slot != SWAP_NONE)
+        swap_free (s->swap_slot);
+      lock_release (&s->lock);
+      file_close (s->file);
+      free (s);
+    }
+}
+
+/* Reads S into a frame if it is not in one and maps it read-only
+   at page P.  Returns S's frame, pinned once more, or a null
+   pointer on failure. */
+struct frame *
+share_load (struct share *s, struct page *p)
+{
+  struct frame *f;
+
+  lock_acquire (&s->lock);
+  f = s->frame;
+  if (f != NULL)
+    f->pin_cnt++;
+  else
+    {
+      f = frame_alloc ();
+      if (f == NULL)
+        goto done;
+      if (s->swap_slot != SWAP_NONE)
+        {
+          swap_in (s->swap_slot, f->kpage);
+          s->swap_slot = SWAP_NONE;
+        }
+      else if (s->read_bytes > 0
+               && file_read_at (s->file, f->kpage, s->read_bytes,
+                                s->file_ofs) != (off_t) s->read_bytes)
+        {
+          frame_free (f);
+          f = NULL;
+          goto done;
+        }
+      else
+        memset ((uint8_t *) f->kpage + s->read_bytes, 0,
+                PGSIZE - s->read_bytes);
+      f->share = s;
+      s->frame = f;
+    }
+
+  if (!p->share_mapped)
+    {
+      if (!pagedir_set_page (p->thread->pagedir, p->upage, f->kpage, false))
+        {
+          f->pin_cnt--;
+          f = NULL;
+          goto done;
+        }
+      list_push_back (&s->pages, &p->share_elem);
+      p->share_mapped = true;
+    }
+
+ done:
+  lock_release (&s->lock);
+  return f;
+}
+
+/* Unpins S's frame once, after share_load(). */
+void
+share_unpin (struct share *s)
+{
+  lock_acquire (&s->lock);
+  ASSERT (s->frame != NULL && s->frame->pin_cnt > 0);
+  s->frame->pin_cnt--;
+  lock_release (&s->lock);
+}
+
+/* Gives page P, which refers to anonymous share S, a private copy
+   of S and drops P's reference to S.  Returns the copy's frame,
+   pinned and holding nothing, or a null pointer if no frame can
+   be had.  P's lock must be held. */
+struct frame *
+share_copy (struct share *s, struct page *p)
+{
+  struct frame *f, *copy;
+  bool last;
+
+  ASSERT (s->file == NULL);
+
+  f = share_load (s, p);
+  if (f == NULL)
+    return NULL;
+
+  /* Only P's owner can add references to S, by forking, so if P
+     holds the only one it stays that way. */
+  lock_acquire (&shares_lock);
+  last = s->ref_cnt == 1;
+  lock_release (&shares_lock);
+
+  if (last)
+    {
+      /* Take over S's frame, still pinned by share_load(). */
+      lock_acquire (&s->lock);
+      s->frame = NULL;
+      f->share = NULL;
+      lock_release (&s->lock);
+      copy = f;
+    }
+  else
+    {
+      copy = frame_alloc ();
+      if (copy != NULL)
+        memcpy (copy->kpage, f->kpage, PGSIZE);
+      share_unpin (s);
+    }
+
+  if (copy != NULL)
+    share_put (s, p);
+  return copy;
+}
+
+/* Returns true if any process accessed S since the last call,
+   and clears the accessed bits.  S's lock must be held. */
+bool
+share_accessed (struct share *s)
+{
+  struct list_elem *e;
+  bool accessed = false;
+
+  for (e = list_begin (&s->pages); e != list_end (&s->pages);
+       e = list_next (e))
+    {
+      struct page *p = list_entry (e, struct page, share_elem);
+      uint32_t *pd = p->thread->pagedir;
+
+      if (pagedir_is_accessed (pd, p->upage))
+        {
+          pagedir_set_accessed (pd, p->upage, false);
+          accessed = true;
+        }
+    }
+  return accessed;
+}
+
+/* Unmaps S from every process so that its frame can be given to
+   another page.  S's lock must be held and its frame pinned.
+   Returns false, leaving S in its frame, if S is anonymous and
+   swap is full. */
+bool
+share_evict (struct share *s)
+{
+  ASSERT (lock_held_by_current_thread (&s->lock));
+  ASSERT (s->frame != NULL);
+
+  /* Nobody can modify S while it is written out, because it is
+     only ever mapped read-only. */
+  if (s->file == NULL && !swap_out (s->frame->kpage, &s->swap_slot))
+    return false;
+
+  while (!list_empty (&s->pages))
+    {
+      struct page *p = list_entry (list_pop_front (&s->pages),
+                                   struct page, share_elem);
+      pagedir_clear_page (p->thread->pagedir, p->upage);
+      p->share_mapped = false;
+    }
+  s->frame = NULL;
+  return true;
+}
+
+/* Returns the share that contains hash element E. */
+static struct share *
+hash_elem_to_share (const struct hash_elem *e)
+{
+  return hash_entry (e, struct share, hash_elem);
+}
+
+static unsigned
+share_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct share *s = hash_elem_to_share (e);
+  return hash_int (s->sector) ^ hash_int (s->file_ofs);
+}
+
+static bool
+share_less (const struct hash_elem *a_, const struct hash_elem *b_,
+            void *aux UNUSED)
+{
+  const struct share *a = hash_elem_to_share (a_);
+  const struct share *b = hash_elem_to_share (b_);
+
+  if (a->sector != b->sector)
+    return a->sector < b->sector;
+  if (a->file_ofs != b->file_ofs)
+    return a->file_ofs < b->file_ofs;
+  return a->read_bytes < b->read_bytes;
+}
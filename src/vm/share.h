@@ -0,0 +1,53 @@
+#ifndef VM_SHARE_H
+#define VM_SHARE_H
+
+#include <hash.h>
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/block.h"
+#include "filesys/off_t.h"
+#include "threads/synch.h"
+
+struct file;
+struct page;
+
+/* A page that several processes map read-only to the same frame.
+   Either it is a read-only page of an executable, shared by every
+   process running that executable, or it is an anonymous page
+   that a process shares copy-on-write with the processes forked
+   from it.  An anonymous share has no FILE and is not in the
+   table of shares; it goes to swap when it is evicted.
+
+   The members above LOCK are protected by shares_lock, those
+   below it by LOCK. */
+struct share
+  {
+    struct hash_elem hash_elem;         /* Element in shares. */
+    block_sector_t sector;              /* Executable's inode sector. */
+    off_t file_ofs;                     /* Offset of the page in it. */
+    size_t read_bytes;                  /* Bytes read; the rest is 0. */
+    struct file *file;                  /* Handle to read it through,
+                                           or null if anonymous. */
+    int ref_cnt;                        /* Number of pages using it. */
+
+    struct lock lock;
+    struct frame *frame;                /* Frame holding it, or null. */
+    struct list pages;                  /* Pages mapped to FRAME. */
+    size_t swap_slot;                   /* Swap slot holding an
+                                           anonymous share, or
+                                           SWAP_NONE. */
+  };
+
+void share_init (void);
+struct share *share_get (struct file *, off_t ofs, size_t read_bytes);
+struct share *share_adopt (struct page *);
+void share_ref (struct share *);
+void share_put (struct share *, struct page *);
+struct frame *share_load (struct share *, struct page *);
+void share_unpin (struct share *);
+struct frame *share_copy (struct share *, struct page *);
+bool share_accessed (struct share *);
+bool share_evict (struct share *);
+
+#endif /* vm/share.h */
@@ -0,0 +1,86 @@
+#include "vm/swap.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <stdio.h>
+#include "devices/block.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* The swap device is divided into page-sized slots, each of
+   which is either free or holds one evicted page.  A bitmap
+   records which slots are in use. */
+
+/* Number of sectors in a swap slot. */
+#define SECTORS_PER_SLOT (PGSIZE / BLOCK_SECTOR_SIZE)
+
+static struct block *swap_device;
+static struct bitmap *used_slots;       /* Slots in use. */
+static struct lock swap_lock;           /* Protects USED_SLOTS. */
+
+/* Initializes the swap slot allocator.  Without a swap device,
+   nothing can be swapped out. */
+void
+swap_init (void)
+{
+  lock_init (&swap_lock);
+  swap_device = block_get_role (BLOCK_SWAP);
+  if (swap_device == NULL)
+    {
+      printf ("swap: no swap device, dirty pages cannot be evicted\n");
+      return;
+    }
+  used_slots = bitmap_create (block_size (swap_device) / SECTORS_PER_SLOT);
+  if (used_slots == NULL)
+    PANIC ("swap: bitmap creation failed");
+}
+
+/* Writes the page at KPAGE to a free swap slot and stores the
+   slot's number into *SLOTP.  Returns false if there is no free
+   slot. */
+bool
+swap_out (const void *kpage, size_t *slotp)
+{
+  const void *buffers[SECTORS_PER_SLOT];
+  size_t slot, i;
+
+  if (swap_device == NULL)
+    return false;
+
+  lock_acquire (&swap_lock);
+  slot = bitmap_scan_and_flip (used_slots, 0, 1, false);
+  lock_release (&swap_lock);
+  if (slot == BITMAP_ERROR)
+    return false;
+
+  for (i = 0; i < SECTORS_PER_SLOT; i++)
+    buffers[i] = (const uint8_t *) kpage + i * BLOCK_SECTOR_SIZE;
+  block_write_multiple (swap_device, slot * SECTORS_PER_SLOT,
+                        SECTORS_PER_SLOT, buffers);
+  *slotp = slot;
+  return true;
+}
+
+/* Reads the page in swap slot SLOT into KPAGE and frees the
+   slot. */
+void
+swap_in (size_t slot, void *kpage)
+{
+  void *buffers[SECTORS_PER_SLOT];
+  size_t i;
+
+  for (i = 0; i < SECTORS_PER_SLOT; i++)
+    buffers[i] = (uint8_t *) kpage + i * BLOCK_SECTOR_SIZE;
+  block_read_multiple (swap_device, slot * SECTORS_PER_SLOT,
+                       SECTORS_PER_SLOT, buffers);
+  swap_free (slot);
+}
+
+/* Frees swap slot SLOT without reading it. */
+void
+swap_free (size_t slot)
+{
+  lock_acquire (&swap_lock);
+  ASSERT (bitmap_test (used_slots, slot));
+  bitmap_reset (used_slots, slot);
+  lock_release (&swap_lock);
+}
@@ -0,0 +1,15 @@
+#ifndef VM_SWAP_H
+#define VM_SWAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Swap slot number for "not in swap". */
+#define SWAP_NONE ((size_t) -1)
+
+void swap_init (void);
+bool swap_out (const void *kpage, size_t *slotp);
+void swap_in (size_t slot, void *kpage);
+void swap_free (size_t slot);
+
+#endif /* vm/swap.h */